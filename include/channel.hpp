@@ -14,6 +14,18 @@
 #include "utils/utils.hpp"
 #include "client.hpp"
 
+// A broadcast to a channel larger than this is delivered BROADCAST_SLICE
+// members at a time, one slice per loop iteration (see advanceBacklogs())
+#ifndef BROADCAST_SLICE
+# define BROADCAST_SLICE 4096
+#endif
+
+// Per-member flags kept in Channel::_memberships (room for +v, ban exemptions...)
+enum MemberFlag
+{
+    MEMBER_OP = 1 << 0,         // channel operator
+    MEMBER_INVITED = 1 << 1     // invited (entry may exist without membership)
+};
 
 class Channel
 {
@@ -21,12 +33,14 @@ class Channel
 	Channel(const std::string &name, Client *creator);
 	~Channel();
 
+	typedef std::vector<Client*> MemberList;
+
 	//Getters básicos
-	std::string getName() const;
-	std::string getTopic() const;
+	const std::string& getName() const;
+	const std::string& getTopic() const;
 	size_t getMemberCount() const;
 	time_t getCreationTime() const;
-	std::string getKey()const;
+	const std::string& getKey()const;
 	
 	//Topic
 	void setTopic(const std::string &topic, Client *setter);
@@ -36,11 +50,15 @@ class Channel
 	bool addMember(Client *client, const std::string &key = "");
 	void removeMember(Client *client);
 	bool isMember(Client *client) const;
-	std::vector<Client*> getMembers() const;
+	const MemberList& getMembers() const;	// iterate in place, don't copy
 	
 	//Message
 	void broadcastMessage(const std::string &message, Client *sender = NULL);
+	void broadcastMessage(const SharedMessage &message, Client *sender = NULL);
 	void sendMessage(const std::string &message, Client *sender, Client *exclude = NULL);
+	static bool hasBacklog();
+	static void advanceBacklogs();
+	void finishBacklog();
 	
 	// Utility
 	std::string getMemberList() const;
@@ -73,14 +91,45 @@ class Channel
 
     
 	private:
+		// Slot in _members, slot of this channel in the client's own list, and
+		// flags; invites to non-members use slot NOT_MEMBER
+		struct Membership
+		{
+			size_t slot;
+			size_t clientSlot;
+			unsigned int flags;
+		};
+		static const size_t NOT_MEMBER = static_cast<size_t>(-1);
+		typedef std::tr1::unordered_map<Client*, Membership> MembershipMap;
+
+		// Broadcast still on its way: members in [cursor, end) have not got
+		// it yet, members that joined after it started sit past end
+		struct Broadcast
+		{
+			SharedMessage	message;
+			Client*			skip;
+			bool			relayed;
+			size_t			cursor;
+			size_t			end;
+		};
+
+		Membership* findMembership(Client *client);
+		const Membership* findMembership(Client *client) const;
+		void deliver(const SharedMessage &message, Client *skip, bool relayed);
+		void deliverRange(const Broadcast &job, size_t from, size_t to);
+		bool advanceBacklog();
+		void unlinkSlot(size_t slot);
 		
 		std::string _name;
 		std::string _topic;
         std::string _topicSetter;
             
-        std::vector<Client*> _members;
-        std::set<Client*> _operators;
-        std::set<Client*> _invitedUsers;
+        MemberList _members;                // contiguous, iterated for fan-out
+        MembershipMap _memberships;         // O(1) membership / op / invite checks
+        std::deque<Broadcast> _backlog;     // sliced broadcasts, oldest first; only the front advances
+
+        static std::vector<Channel*> _backlogged;  // channels with a non-empty backlog
+        static int _backloggedCount;               // its size, readable without the state lock
         
 		Client* _creator;
 		time_t _creationTime;
@@ -15,47 +15,110 @@
 
 #include "server.hpp"
 
+class Server;
+class Channel;
 
 class	Client
 {
 	private:
+		// Output queue entry: a private segment small replies are coalesced
+		// into, or a reference to a payload shared with other recipients
+		struct OutSegment
+		{
+			std::string		data;
+			SharedMessage	shared;
+
+			const std::string& bytes() const { return shared ? *shared : data; }
+		};
+
 		int	_clientFd;
+		unsigned long	_serial;	// unique per connection, tells fd reuse apart
 		std::string	_nick;
 		std::string	_user;
-		std::vector<std::string> _channelsList;
-		std::string	_buff;
+		std::vector<Channel*> _channelsList;	// slots mirrored in each channel's membership
+		std::vector<char>	_buff;	// input buffer, only ever grows
+		size_t	_buffStart;		// first byte not yet handled
+		size_t	_buffLen;		// end of the received data in _buff
+		bool	_discardingLine;	// skipping the rest of an overlong line
+		unsigned int	_inputBreaches;	// overlong lines received so far
+		bool	_inputScheduled;	// on the reactor's pending input list
+		bool	_readPaused;		// input backlog full, EPOLLIN is off
+		long	_floodTokens;		// flood bucket in thousandths of a token (< 0 = in debt)
+		unsigned long	_floodStamp;	// monotonicMs() of the last refill
 		std::string	_pass;
 		std::string	_host;
+		std::string	_prefix;	// ":nick!user@host", rebuilt when any part changes
 		bool	_authenticated;
-		bool	_shouldquit;
+		bool	_dead;			// waiting to be reaped at the end of the tick
+		std::string	_quitReason;	// sent to its channels in the QUIT
+		bool	_invited;		// some channel may hold an invite for it
+		unsigned long	_fanoutMark;	// last Server fan-out that reached it
+		Server*	_server;		// reactor that owns this socket (and the output queue)
+		std::deque<OutSegment>	_outQueue;	// segments queued for the socket
+		size_t	_outOffset;		// bytes of the front segment already sent
+		size_t	_outBytes;		// total bytes still queued
+		bool	_wantWrite;		// waiting for EPOLLOUT
+		bool	_flushScheduled;	// already on the reactor's flush list
+		bool	_sendqExceeded;		// hit SENDQ_HARD_LIMIT, output is discarded
+
+		void updatePrefix();
+		void updateEvents();
+		std::string& outputSegment(size_t len);
+		void outputQueued(size_t len);
 
 	public:
-		Client(int fd);		
+		Client(int fd, Server *server);		
 		~Client();
 		int getFd() const;
+		unsigned long getSerial() const;
 		void setNick(const std::string &nickname);
-		std::string getNick() const;
+		const std::string& getNick() const;
 		void setUser(const std::string &username);
-		std::string getUser() const;
-		void setShouldQuit(bool shouldQuit);
-		bool getShouldQuit() const;
+		const std::string& getUser() const;
+		bool markDead(const std::string &reason);
+		bool isDead() const;
+		const std::string& getQuitReason() const;
+		void setInvited();
+		bool wasInvited() const;
+		bool markFanout(unsigned long fanout);
 		void setPass(const std::string &password);
-		std::string getPass() const;
-		void setCurrChannel(const std::string &channel);
-		std::string getCurrChannel() const;
-		std::string& getBuffer();
-		std::string getHost() const;
+		const std::string& getPass() const;
+		const char* getBuffer() const;
+		size_t getBufferSize() const;
+		void consumeBuffer(size_t len);
+		bool isDiscardingLine() const;
+		void setDiscardingLine(bool discarding);
+		unsigned int addInputBreach();
+		bool isInputScheduled() const;
+		void setInputScheduled(bool scheduled);
+		void setReadPaused(bool paused);
+		void spendFloodTokens(unsigned int cost);
+		unsigned long floodDelay(unsigned long now);
+		const std::string& getHost() const;
 		void setHost(const std::string &host);
-		void addChannel(const std::string &channel);
-		void removeChannel(const std::string &channel);
-		bool isInChannel(const std::string &channel) const;
-		std::vector<std::string> getChannels() const;
+		const std::string& getPrefix() const;
+		std::string relayMessage(const char *command, const std::string &params) const;
+		std::string relayMessage(const char *command, const std::string &params,
+			const std::string &trailing) const;
+		size_t linkChannel(Channel *channel);
+		Channel* unlinkChannel(size_t slot);
+		bool isInChannel(Channel *channel) const;
+		const std::vector<Channel*>& getChannels() const;
 		size_t getChannelCount() const;
-		void clearChannels();
 		bool isAuthenticated() const;
 		void authenticate();
 		void sendMessage(const std::string &message);
-		std::string receiveMessage();
+		void sendMessage(const SharedMessage &message);
+		void sendParts(const StringView *parts, size_t count);
+		void sendRelayed(const std::string &message);
+		void sendRelayed(const SharedMessage &message);
+		bool flushOutput();
+		bool hasPendingOutput() const;
+		size_t getOutBytes() const;
+		bool isSendQThrottled() const;
+		bool isSendQExceeded() const;
+		void abortOutput(const std::string &line);
+		size_t receiveMessage();
 		void disconnect();
 };
 
@@ -0,0 +1,69 @@
+#ifndef FANOUT_HPP
+#define FANOUT_HPP
+
+#include "utils/utils.hpp"
+#include "message.hpp"
+#include <pthread.h>
+
+// Channels with at least this many members are fanned out by the pool
+#ifndef FANOUT_MIN_MEMBERS
+# define FANOUT_MIN_MEMBERS 4096
+#endif
+#define FANOUT_MAX_WORKERS 32
+
+class Client;
+class Server;
+
+/**
+ * Optional worker threads for broadcasts into very large channels
+ * (IRCSERV_FANOUT_WORKERS, off by default). The member array is cut into
+ * one contiguous slice per worker plus one for the calling reactor, which
+ * waits for all of them: every recipient is handled by exactly one thread
+ * and the broadcast is complete when run() returns, so each recipient
+ * still sees its messages in order.
+ *
+ * Keep it off unless a measurement says otherwise: tools/fanoutbench has
+ * not shown it beating the sliced delivery of Channel::deliver().
+ *
+ * The workers act on behalf of the calling reactor: its own clients are
+ * queued directly, the others go through their reactor's inbox. Only one
+ * broadcast runs at a time (callers hold the ServerState lock).
+ */
+class FanoutPool
+{
+	public:
+		static void start(unsigned int workers);
+		static void stop();
+		static bool covers(size_t members)
+		{
+			return _workers > 0 && members >= FANOUT_MIN_MEMBERS;
+		}
+		static void run(const std::vector<Client*> &members, Client *skip,
+			const SharedMessage &message, bool relayed);
+
+	private:
+		struct Job
+		{
+			const std::vector<Client*>	*members;
+			Client						*skip;
+			SharedMessage				message;
+			bool						relayed;
+			Server						*reactor;
+		};
+
+		static unsigned int		_workers;
+		static pthread_t		_threads[FANOUT_MAX_WORKERS];
+		static std::vector<int>	_flushes[FANOUT_MAX_WORKERS];	// fds each worker left to flush
+		static Job				_job;
+		static unsigned long	_generation;	// bumped for every job
+		static unsigned int		_pending;		// workers still busy with it
+		static bool				_stopping;
+		static pthread_mutex_t	_mutex;
+		static pthread_cond_t	_wakeup;
+		static pthread_cond_t	_done;
+
+		static void *worker(void *arg);
+		static void deliver(const Job &job, size_t slice);
+};
+
+#endif // FANOUT_HPP
@@ -0,0 +1,133 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include "utils/utils.hpp"
+#include <stdint.h>
+
+// Bytes of formatted log lines held between two drains of the ring (a
+// multiple of 8)
+#ifndef LOG_RING_SIZE
+# define LOG_RING_SIZE (1024 * 1024)
+#endif
+// Longer lines are cut (and end in "...")
+#define LOG_LINE_MAX 512
+// Lines handed to one writev() by Log::flush()
+#define LOG_FLUSH_IOV 64
+
+enum LogLevel
+{
+	LEVEL_DEBUG,
+	LEVEL_INFO,
+	LEVEL_WARN,
+	LEVEL_ERROR
+};
+
+enum LogCategory
+{
+	LOG_SERVER = 1 << 0,	// listener, event loop, fds
+	LOG_CLIENT = 1 << 1,	// connections, registration, disconnects
+	LOG_COMMAND = 1 << 2,	// per-command tracing
+	LOG_CHANNEL = 1 << 3,	// joins, parts, modes, topics
+	LOG_ALL = LOG_SERVER | LOG_CLIENT | LOG_COMMAND | LOG_CHANNEL
+};
+
+/**
+ * Log lines are formatted straight into a ring buffer and written out once
+ * per loop iteration (Log::flush() in the idle phase), so logging never
+ * costs a syscall on the path of a command. When the ring is full, lines
+ * are dropped and counted rather than blocking. The ring is shared by all
+ * reactor threads without a lock: a line is claimed with a CAS on _head and
+ * marked ready once copied, and the thread that flushes stops at the first
+ * line not ready yet. The timestamp is cached per thread.
+ */
+class Log
+{
+	public:
+		static bool enabled(LogLevel level, LogCategory category)
+		{
+			return level >= _level && (_categories & category);
+		}
+		static void configure(const char *level, const char *categories);
+		static void open();
+		static void close();
+		static void tick();
+		static void flush();
+		static void push(const char *line, size_t len);
+		static const char *stamp() { return _stamp; }
+
+	private:
+		// Every line is stored behind one of these, padded to a multiple of
+		// 8 bytes so a header never wraps around the end of the ring
+		struct Record
+		{
+			uint32_t	len;	// bytes of text that follow
+			uint32_t	ready;	// set once the text is copied in
+		};
+
+		static LogLevel		_level;
+		static unsigned int	_categories;
+		static char			_ring[LOG_RING_SIZE];
+		static size_t		_head;		// total bytes ever claimed by writers
+		static size_t		_tail;		// total bytes ever released by the flusher
+		static size_t		_sent;		// text of the oldest record already written out
+		static size_t		_dropped;	// lines lost to a full ring since the last flush
+		static int			_flushing;	// one thread writes the ring out at a time
+		static int			_stdoutFlags;	// as found by open(), -1 before it
+
+		static size_t recordSize(size_t len)
+		{
+			return (sizeof(Record) + len + 7) & ~static_cast<size_t>(7);
+		}
+		static Record *recordAt(size_t pos)
+		{
+			return reinterpret_cast<Record *>(_ring + pos % LOG_RING_SIZE);
+		}
+		static void release(size_t written);
+		static __thread time_t	_stampTime;
+		static __thread char	_stamp[16];	// "HH:MM:SS", refreshed by tick()
+};
+
+// One line being formatted; it is pushed to the ring when destroyed
+class LogLine
+{
+	public:
+		LogLine(LogLevel level, LogCategory category);
+		~LogLine();
+
+		LogLine &operator<<(const char *str);
+		LogLine &operator<<(const std::string &str);
+		LogLine &operator<<(const StringView &str);
+		LogLine &operator<<(char c);
+		LogLine &operator<<(int n);
+		LogLine &operator<<(unsigned int n);
+		LogLine &operator<<(long n);
+		LogLine &operator<<(unsigned long n);
+
+	private:
+		char	_buf[LOG_LINE_MAX];
+		size_t	_len;
+
+		void append(const char *data, size_t len);
+
+		LogLine(const LogLine &);
+		LogLine &operator=(const LogLine &);
+};
+
+// LOG_INFO(LOG_CLIENT) << "text " << value; arguments are only evaluated
+// when the level and category are enabled (a loop rather than an if/else,
+// so the macro is safe as the body of an unbraced if)
+#define LOG_AT(level, category) \
+	for (bool log_once_ = Log::enabled(level, category); log_once_; log_once_ = false) \
+		LogLine(level, category)
+
+// Debug tracing only exists in builds made with -DIRC_DEBUG_LOG (make debug)
+#ifdef IRC_DEBUG_LOG
+# define LOG_DEBUG(category) LOG_AT(LEVEL_DEBUG, category)
+#else
+# define LOG_DEBUG(category) while (false) LogLine(LEVEL_DEBUG, category)
+#endif
+#define LOG_INFO(category) LOG_AT(LEVEL_INFO, category)
+#define LOG_WARN(category) LOG_AT(LEVEL_WARN, category)
+#define LOG_ERROR(category) LOG_AT(LEVEL_ERROR, category)
+
+#endif // LOG_HPP
@@ -0,0 +1,45 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include "utils/utils.hpp"
+
+// RFC 2812: at most 14 middle parameters plus one trailing
+#define IRC_MAX_PARAMS 15
+// Longest line accepted, CRLF excluded (512 bytes on the wire)
+#ifndef IRC_MAX_LINE
+# define IRC_MAX_LINE 510
+#endif
+// Extra room a tagged line gets for its "@tags " section (IRCv3)
+#ifndef IRC_MAX_TAGS
+# define IRC_MAX_TAGS 8191
+#endif
+
+/**
+ * One parsed IRC line. Every field is a view into the line it was parsed
+ * from, so it is only valid while that line is (the client's input buffer
+ * during dispatch).
+ *
+ *   [@tags] [:prefix] COMMAND [middle ...] [:trailing]
+ */
+struct IrcMessage
+{
+	StringView	tags;		// IRCv3 tags without the '@' (ignored for now)
+	StringView	prefix;		// source without the ':'
+	StringView	command;	// command name or numeric, as sent
+	StringView	params[IRC_MAX_PARAMS];
+	size_t		paramCount;
+	bool		hasTrailing;	// last param was given after " :"
+	StringView	rawParams;	// everything after the command, for logging
+
+	IrcMessage();
+	const StringView &param(size_t index) const;	// empty view when missing
+};
+
+// Immutable outgoing message formatted once and queued to many clients
+typedef std::tr1::shared_ptr<const std::string> SharedMessage;
+
+bool parseMessage(const StringView &line, IrcMessage &msg);
+bool nextListItem(const StringView &list, size_t &pos, StringView &item);
+size_t maxLineLength(const StringView &line);
+
+#endif // MESSAGE_HPP
@@ -0,0 +1,60 @@
+#ifndef REPLIES_HPP
+#define REPLIES_HPP
+
+#include "utils/utils.hpp"
+
+class Client;
+
+/**
+ * Numeric replies. Each one is written straight into the recipient's output
+ * queue: the pieces are sized first and copied once, no temporary strings.
+ * The target of every numeric is the recipient's nick ("*" before NICK).
+ */
+
+// Registration
+void rplWelcome(Client *to);												// 001
+void rplYourHost(Client *to);												// 002
+void rplCreated(Client *to);												// 003
+void rplMyInfo(Client *to);													// 004
+
+// Command replies
+void rplAway(Client *to, const StringView &nick, const StringView &message);		// 301
+void rplEndOfWho(Client *to, const StringView &name);								// 315
+void rplChannelModeIs(Client *to, const StringView &channel, const StringView &modes);	// 324
+void rplNoTopic(Client *to, const StringView &channel);								// 331
+void rplTopic(Client *to, const StringView &channel, const StringView &topic);		// 332
+void rplTopicWhoTime(Client *to, const StringView &channel, const StringView &nick,
+	const StringView &time);														// 333
+void rplInviting(Client *to, const StringView &nick, const StringView &channel);	// 341
+void rplWhoReply(Client *to, const StringView &channel, const Client *who,
+	const StringView &flags);														// 352
+void rplNamReply(Client *to, const StringView &channel, const StringView &names);	// 353
+void rplEndOfNames(Client *to, const StringView &channel);							// 366
+
+// Errors
+void errNoSuchNick(Client *to, const StringView &nick);						// 401
+void errNoSuchChannel(Client *to, const StringView &channel);				// 403
+void errCannotSendToChan(Client *to, const StringView &channel);			// 404
+void errTooManyChannels(Client *to, const StringView &channel);				// 405
+void errNoRecipient(Client *to, const StringView &command);					// 411
+void errNoTextToSend(Client *to);											// 412
+void errInputTooLong(Client *to);											// 417
+void errUnknownCommand(Client *to, const StringView &command);				// 421
+void errNoNicknameGiven(Client *to);										// 431
+void errErroneusNickname(Client *to, const StringView &nick);				// 432
+void errNicknameInUse(Client *to, const StringView &nick);					// 433
+void errUserNotInChannel(Client *to, const StringView &nick, const StringView &channel);	// 441
+void errNotOnChannel(Client *to, const StringView &channel);				// 442
+void errUserOnChannel(Client *to, const StringView &nick, const StringView &channel);	// 443
+void errNotRegistered(Client *to);											// 451
+void errNeedMoreParams(Client *to, const StringView &command);				// 461
+void errAlreadyRegistred(Client *to);										// 462
+void errPasswdMismatch(Client *to);											// 464
+void errKeySet(Client *to, const StringView &channel);						// 467
+void errChannelIsFull(Client *to, const StringView &channel);				// 471
+void errUnknownMode(Client *to, char mode, const StringView &channel);		// 472
+void errInviteOnlyChan(Client *to, const StringView &channel);				// 473
+void errBadChannelKey(Client *to, const StringView &channel);				// 475
+void errChanOPrivsNeeded(Client *to, const StringView &channel);			// 482
+
+#endif // REPLIES_HPP
@@ -2,48 +2,211 @@
 #define SERVER_HPP
 
 #include "utils/utils.hpp"
+#include "message.hpp"
 #include "client.hpp"
+#include "replies.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+#include <pthread.h>
+
+// Name the server uses as the source of its own numerics
+#define SERVER_NAME "irc.local"
+#define SERVER_VERSION "ft_IRC-1.0"
+// Initial size of the epoll_wait() event array (doubled whenever a wait fills it)
+#define EPOLL_MAX_EVENTS 256
+// Small replies are coalesced into output segments of up to this size
+#define OUT_SEGMENT_SIZE 4096
+// Maximum number of segments handed to a single sendmsg() call
+#define OUT_IOV_MAX 64
+// Per-client send queue limits, in bytes the socket has not taken yet.
+// Past the soft limit relayed chat to the client is dropped; past the hard
+// limit it is disconnected with "ERROR :SendQ exceeded".
+#ifndef SENDQ_SOFT_LIMIT
+# define SENDQ_SOFT_LIMIT (256 * 1024)
+#endif
+#ifndef SENDQ_HARD_LIMIT
+# define SENDQ_HARD_LIMIT (1024 * 1024)
+#endif
+// Free space guaranteed in a client's input buffer before each recv()
+#define RECV_CHUNK_SIZE 16384
+// Unprocessed input held per client; reading stops for the tick once reached
+#ifndef INPUT_BUFFER_CAP
+# define INPUT_BUFFER_CAP (64 * 1024)
+#endif
+// Flood control: every command costs tokens (see the command table) from a
+// per-client bucket holding at most FLOOD_BURST tokens and refilled at
+// FLOOD_RATE tokens per second. An empty bucket leaves the lines queued.
+#ifndef FLOOD_BURST
+# define FLOOD_BURST 32
+#endif
+#ifndef FLOOD_RATE
+# define FLOOD_RATE 8
+#endif
+// Commands run per client per loop iteration, so one busy client cannot
+// hold up the others; the rest wait for the next iteration
+#ifndef INPUT_TICK_BUDGET
+# define INPUT_TICK_BUDGET 16
+#endif
+// Overlong lines tolerated from one client before it is disconnected
+#ifndef MAX_INPUT_BREACHES
+# define MAX_INPUT_BREACHES 3
+#endif
+// Upper bound for the [threads] argument (one reactor per thread)
+#define MAX_REACTORS 64
 
 class Client;
 class Channel;
+class Server;
+
+// Everything the reactors share: only touched with lock() held. With a
+// single reactor the lock is a no-op. There is one lock for all of it,
+// taken for every command, so commands never run in parallel whatever the
+// number of reactors; only socket I/O does.
+struct ServerState
+{
+	std::tr1::unordered_map<std::string, Client*, IrcCaseHash, IrcCaseEqual> nicks; // casemapped nick index
+	std::map<std::string, Channel*> channels;
+	unsigned long fanoutEpoch;		// id of the last sendToPeers() call
+	std::vector<Server*> reactors;	// woken up at shutdown
+	int stopping;					// set (atomically) by stopAll()
+	bool threaded;
+	pthread_mutex_t mutex;
+
+	ServerState(bool threaded);
+	~ServerState();
+	void lock();
+	void unlock();
+	void stopAll();
+};
+
+// Holds the ServerState lock for the scope
+class StateLock
+{
+	public:
+		StateLock(ServerState &state) : _state(state) { _state.lock(); }
+		~StateLock() { _state.unlock(); }
+
+	private:
+		ServerState &_state;
+
+		StateLock(const StateLock &);
+		StateLock &operator=(const StateLock &);
+};
+
+// Index of each command in Server::_commands
+enum CommandId
+{
+	CMD_JOIN, CMD_PART, CMD_KICK, CMD_INVITE, CMD_TOPIC, CMD_MODE, CMD_PASS,
+	CMD_NICK, CMD_USER, CMD_PRIVMSG, CMD_QUIT, CMD_WHO, CMD_CAP, CMD_COUNT
+};
 
 class Server 
 {
+	// tools/*bench.cpp register clients and run commands without an event loop
+	friend class ServerBench;
+
 	private:
 		int _port;
 		std::string _pass;
-//		int _epoll_fd;
+		int _epoll_fd;
 		int _server_fd;
-		std::vector<Client*> _clients;
-	    std::map<std::string, Channel*> _channels;
+		int _spare_fd;			// reserved for shedding connections at the fd limit
+		int _wake_fd;			// eventfd signalled when the inbox goes non-empty (-1 = single reactor)
+		std::vector<Client*> _clients;		// dense list of connected clients
+		std::vector<int> _clientSlots;		// fd -> index in _clients (-1 = free)
+		std::vector<int> _pendingFlush;		// fds with output queued this tick
+		std::vector<int> _pendingInput;		// fds with complete lines not run yet
+		std::vector<Client*> _deadClients;	// disconnected this tick, reaped at its end
+		ServerState &_state;
+		// shared with the other reactors, see ServerState
+		std::tr1::unordered_map<std::string, Client*, IrcCaseHash, IrcCaseEqual> &_nicks;
+	    std::map<std::string, Channel*> &_channels;
+		unsigned long &_fanoutEpoch;
+
+		// Message for one of our clients queued by another reactor. The
+		// client is named by fd and serial: it may be gone by the time the
+		// node is read.
+		struct InboxNode
+		{
+			InboxNode*		next;
+			int				fd;
+			unsigned long	serial;
+			SharedMessage	message;
+			bool			relayed;	// dropped if the client is over its soft sendQ limit
+		};
+		InboxNode* volatile _inbox;		// lock-free MPSC stack, newest first
+		bool _draining;					// delivering the inbox, see catchUpInbox()
+
+		static __thread Server* _current;	// reactor running on this thread
+		static __thread std::vector<int>* _flushList;	// fan-out worker's flush list, see enterFanout()
+
+		// Dispatch table entry: what the dispatcher checks before calling handler
+		struct Command
+		{
+			const char*	name;
+			void		(Server::*handler)(Client* client, const IrcMessage &msg); // NULL = ignored
+			bool		needsRegistration;	// ERR_NOTREGISTERED before PASS/NICK/USER
+			size_t		minParams;			// ERR_NEEDMOREPARAMS below this
+			unsigned int	cost;			// flood-control tokens charged
+		};
+		static const Command _commands[CMD_COUNT];
+		static const Command* findCommand(const StringView &name);
 
 	    Client* getClientByFd(int fd);
-    	std::string cleanInput(const std::string& input, const std::string& toRemove);
-	    void rebuildPollFds(std::vector<struct pollfd>& pollfds);
+	    Client* getClientByNick(const std::string &nick);
+	    void addClient(Client* client);
+	    void removeClient(Client* client);
+	    void addToEpoll(int fd);
+	    void removeFromEpoll(int fd);
+	    void dropClient(Client* client, const std::string &reason);
+	    bool shedConnection();
+	    void rejectLongLine(Client* client);
+	    void reapDeadClients();
+	    void scheduleInput(Client* client);
+	    void processInput(Client* client);
+	    void processPendingInput();
+	    int inputWaitTimeout();
+	    void drainInbox();
+	    void deliverInbox();
+	    bool isRunning();
 
 	public:
-		Server(int port, const std::string &pass);
+		Server(int port, const std::string &pass, ServerState &state);
 		~Server();
 
 		void start();
+		void setup();
+		void run();
+		void wake();
+		bool isForeign() const { return _current != this; }
+		static Server* current() { return _current; }
+		static void enterFanout(Server* reactor, std::vector<int>* flushList);
+		void post(Client* client, const SharedMessage &message, bool relayed);
+		void catchUpInbox();
 		void acceptClient();
 		void handleClient(int client_fd);
 		void cleanup();
-		void removeClientFromAllChannels(Client* client);
-
-		void parseCommand(int client_fd, const std::string &command);
-		void joinCommand(int client_fd, const std::string &params);
-		void partCommand(int client_fd, const std::string &params);
-		void kickCommand(int client_fd, const std::string &params);
-		void inviteCommand(int client_fd, const std::string &params);
-		void topicCommand(int client_fd, const std::string &params);
-		void modeCommand(int client_fd, const std::string &params);
-		void passCommand(int client_fd, const std::string &params);
-		void nickCommand(int client_fd, const std::string &params);
-		void userCommand(int client_fd, const std::string &params);
-		void privmsgCommand(int client_fd, const std::string &params);
-		void quitCommand(int client_fd, const std::string &params);
-		void whoCommand(int client_fd, const std::string &params);
+		void removeClientFromAllChannels(Client* client, const std::string &reason = "Client disconnected");
+		void disconnectClient(Client* client, const std::string &reason);
+		void sendToPeers(Client* client, const SharedMessage &message);
+		void watchEvents(int fd, bool readable, bool writable);
+		void scheduleFlush(Client* client);
+		void scheduleFlushes(const std::vector<int> &fds);
+		void flushPendingClients();
+
+		unsigned int parseCommand(int client_fd, const StringView &line); // returns the CommandId
+		void joinCommand(Client* client, const IrcMessage &msg);
+		void partCommand(Client* client, const IrcMessage &msg);
+		void kickCommand(Client* client, const IrcMessage &msg);
+		void inviteCommand(Client* client, const IrcMessage &msg);
+		void topicCommand(Client* client, const IrcMessage &msg);
+		void modeCommand(Client* client, const IrcMessage &msg);
+		void passCommand(Client* client, const IrcMessage &msg);
+		void nickCommand(Client* client, const IrcMessage &msg);
+		void userCommand(Client* client, const IrcMessage &msg);
+		void privmsgCommand(Client* client, const IrcMessage &msg);
+		void quitCommand(Client* client, const IrcMessage &msg);
+		void whoCommand(Client* client, const IrcMessage &msg);
 
 		void sendError(int client_fd, const std::string &error);
 
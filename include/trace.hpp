@@ -0,0 +1,98 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <stdint.h>
+#include <ctime>
+
+// Records kept in the trace file; must be a power of two
+#ifndef TRACE_RECORDS
+# define TRACE_RECORDS 65536
+#endif
+#define TRACE_MAGIC "IRCTRACE"
+#define TRACE_VERSION 1
+// Command names stored in the file header, so the decoder needs no table
+#define TRACE_MAX_COMMANDS 32
+#define TRACE_NAME_LEN 16
+
+enum TraceEvent
+{
+	TRACE_ACCEPT = 1,	// fd
+	TRACE_REFUSED,		// out of fds, the connection was closed at once
+	TRACE_READ,			// fd, bytes received
+	TRACE_COMMAND,		// fd, command, latency, bytes (line length)
+	TRACE_DROP,			// fd, bytes still queued (server-side disconnect)
+	TRACE_DISCONNECT	// fd, bytes of output lost at teardown
+};
+
+// Both structs are written as-is to the file: fixed-width fields only
+struct TraceRecord
+{
+	uint64_t	time;		// ns since the trace was opened (CLOCK_MONOTONIC)
+	uint32_t	seq;		// low 32 bits of (index + 1); 0 = never written
+	uint16_t	event;		// TraceEvent
+	uint16_t	command;	// CommandId, CMD_COUNT for unknown commands
+	int32_t		fd;
+	uint32_t	latency;	// ns spent running the command
+	uint64_t	bytes;
+};
+
+struct TraceHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	recordSize;
+	uint64_t	capacity;		// records in the ring
+	uint64_t	head;			// records ever claimed; the newest is head - 1
+	uint64_t	startRealtime;	// wall clock (ns since the epoch) at time 0
+	char		commands[TRACE_MAX_COMMANDS][TRACE_NAME_LEN];
+};
+
+/**
+ * Binary event ring in a MAP_SHARED file. Recording is a few stores into
+ * the mapping (no syscall, no formatting), and since the pages belong to
+ * the file, whatever was recorded is still there when the process dies.
+ * Decode it with ./tracedump <file>.
+ */
+class Trace
+{
+	public:
+		static bool open(const char *path);
+		static void close();
+		static void nameCommand(unsigned int id, const char *name);
+
+		// 0 when tracing is off, so callers can time unconditionally
+		static uint64_t clock()
+		{
+			if (!_header)
+				return 0;
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec - _start;
+		}
+
+		static void record(TraceEvent event, int fd, uint64_t bytes = 0,
+			unsigned int command = 0, uint64_t latency = 0)
+		{
+			if (!_header)
+				return;
+			// reactor threads claim their slots atomically
+			uint64_t index = __sync_fetch_and_add(&_header->head, 1);
+			TraceRecord &r = _records[index & (TRACE_RECORDS - 1)];
+			r.time = clock();
+			r.event = event;
+			r.command = command;
+			r.fd = fd;
+			r.latency = latency > 0xffffffffULL ? 0xffffffffU : static_cast<uint32_t>(latency);
+			r.bytes = bytes;
+			// written last: a record cut short by a crash keeps a stale seq
+			r.seq = static_cast<uint32_t>(index + 1);
+		}
+
+	private:
+		static TraceHeader	*_header;	// NULL = tracing off
+		static TraceRecord	*_records;
+		static size_t		_size;		// bytes mapped
+		static uint64_t		_start;		// CLOCK_MONOTONIC at open, in ns
+};
+
+#endif // TRACE_HPP
@@ -0,0 +1,75 @@
+#ifndef STRINGVIEW_HPP
+#define STRINGVIEW_HPP
+
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <ostream>
+
+// Non-owning view of a run of characters (C++98 stand-in for string_view).
+// Used to hand lines and tokens around without copying them out of the
+// client's input buffer; the view is only valid while that buffer is.
+class StringView
+{
+	public:
+		static const size_t npos = static_cast<size_t>(-1);
+
+		StringView() : _data(""), _size(0) {}
+		StringView(const char *data, size_t size) : _data(data), _size(size) {}
+		StringView(const char *str) : _data(str), _size(std::strlen(str)) {}
+		StringView(const std::string &str) : _data(str.data()), _size(str.size()) {}
+
+		const char *data() const { return _data; }
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		char operator[](size_t i) const { return _data[i]; }
+		std::string str() const { return std::string(_data, _size); }
+
+		StringView substr(size_t pos, size_t len = npos) const
+		{
+			if (pos > _size)
+				pos = _size;
+			if (len > _size - pos)
+				len = _size - pos;
+			return StringView(_data + pos, len);
+		}
+
+		size_t find(char c, size_t pos = 0) const
+		{
+			if (pos >= _size)
+				return npos;
+			const void *hit = std::memchr(_data + pos, c, _size - pos);
+			return hit ? static_cast<const char *>(hit) - _data : npos;
+		}
+
+		bool operator==(const StringView &other) const
+		{
+			return _size == other._size && std::memcmp(_data, other._data, _size) == 0;
+		}
+		bool operator!=(const StringView &other) const { return !(*this == other); }
+
+		// ASCII case-insensitive comparison (command names)
+		bool iequals(const StringView &other) const
+		{
+			if (_size != other._size)
+				return false;
+			for (size_t i = 0; i < _size; i++)
+			{
+				if (std::toupper(static_cast<unsigned char>(_data[i]))
+					!= std::toupper(static_cast<unsigned char>(other._data[i])))
+					return false;
+			}
+			return true;
+		}
+
+	private:
+		const char *_data;
+		size_t _size;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const StringView &view)
+{
+	return os.write(view.data(), view.size());
+}
+
+#endif // STRINGVIEW_HPP
@@ -12,8 +12,11 @@
 
 #include "channel.hpp"
 #include "client.hpp"
+#include "fanout.hpp"
 #include "utils/utils.hpp"
 
+std::vector<Channel*> Channel::_backlogged;
+int Channel::_backloggedCount = 0;
 
 Channel::Channel(const std::string &name, Client *creator) 
     : _name(name), 
@@ -27,21 +30,30 @@ Channel::Channel(const std::string &name, Client *creator)
       _topicTime(0)
 {
     // Adicionar o criador como membro e operador
+    Membership entry;
+    entry.slot = 0;
+    entry.clientSlot = creator->linkChannel(this);
+    entry.flags = MEMBER_OP;
     _members.push_back(creator);
-    _operators.insert(creator);
+    _memberships[creator] = entry;
 }
 
 Channel::~Channel()
-{}
+{
+    if (_backlog.empty())
+        return;
+    _backlogged.erase(std::find(_backlogged.begin(), _backlogged.end(), this));
+    __sync_fetch_and_sub(&_backloggedCount, 1);
+}
 
 
 // Getters básicos
-std::string Channel::getName() const
+const std::string& Channel::getName() const
 {
     return (this->_name);
 }
 
-std::string Channel::getTopic() const
+const std::string& Channel::getTopic() const
 {
     return (this->_topic);
 }
@@ -56,7 +68,7 @@ time_t Channel::getCreationTime() const
     return (this->_creationTime);
 }
 
-std::string Channel::getKey() const
+const std::string& Channel::getKey() const
 {
     return (this->_key);
 }
@@ -102,35 +114,105 @@ bool Channel::addMember(Client* client, const std::string& key)
     if (_channelKey && key != _key)
         return false;
     
-    // Adicionar o membro
+    // Adicionar o membro (um convite pendente é consumido)
+    Membership &entry = _memberships[client];
+    entry.slot = _members.size();
+    entry.clientSlot = client->linkChannel(this);
+    entry.flags &= ~MEMBER_INVITED;
     _members.push_back(client);
     
-    // Remover dos convites se estava convidado
-    if (isInvited(client))
-        removeInvite(client);
-    
     return true;
 }
 void Channel::removeMember(Client* client)
 {
-    // Remover dos membros
-    std::vector<Client*>::iterator it = std::find(_members.begin(), _members.end(), client);
-    if (it != _members.end())
-        _members.erase(it);
+    MembershipMap::iterator it = _memberships.find(client);
+    if (it == _memberships.end())
+        return;
     
-    // Remover dos operadores se for operador
-    _operators.erase(client);
+    // Remover dos membros: o último membro ocupa o lugar libertado
+    size_t slot = it->second.slot;
+    if (slot != NOT_MEMBER)
+    {
+        unlinkSlot(slot);
+        
+        // Desligar também do lado do cliente
+        size_t clientSlot = it->second.clientSlot;
+        Channel* moved = client->unlinkChannel(clientSlot);
+        if (moved)
+            moved->findMembership(client)->clientSlot = clientSlot;
+    }
     
-    // Remover dos convidados se estiver convidado
-    _invitedUsers.erase(client);
+    // Remover também o estatuto de operador e convites
+    _memberships.erase(client);
+}
+
+// Frees a slot of _members. Without a sliced broadcast in progress the last
+// member simply takes it. Otherwise every member has to keep its place
+// relative to each job's cursor and end: the member leaving first gets the
+// messages still owed to it, then the hole is rotated up through each
+// boundary above it (the last member of every segment moves down into the
+// hole) and the boundaries shift down by one.
+void Channel::unlinkSlot(size_t slot)
+{
+    Client* leaving = _members[slot];
+    std::vector<size_t> bounds;
+    for (std::deque<Broadcast>::iterator job = _backlog.begin(); job != _backlog.end(); ++job)
+    {
+        if (slot >= job->cursor && slot < job->end && job->skip != leaving)
+        {
+            if (job->relayed)
+                leaving->sendRelayed(job->message);
+            else
+                leaving->sendMessage(job->message);
+        }
+        if (job->skip == leaving)
+            job->skip = NULL;
+        if (job->cursor > slot)
+            bounds.push_back(job->cursor);
+        if (job->end > slot)
+            bounds.push_back(job->end);
+    }
+    bounds.push_back(_members.size());
+    std::sort(bounds.begin(), bounds.end());
+    size_t hole = slot;
+    for (size_t i = 0; i < bounds.size(); i++)
+    {
+        size_t last = bounds[i] - 1;
+        if (last == hole)
+            continue;
+        _members[hole] = _members[last];
+        findMembership(_members[hole])->slot = hole;
+        hole = last;
+    }
+    _members.pop_back();
+    for (std::deque<Broadcast>::iterator job = _backlog.begin(); job != _backlog.end(); ++job)
+    {
+        if (job->cursor > slot)
+            job->cursor--;
+        if (job->end > slot)
+            job->end--;
+    }
+}
+
+Channel::Membership* Channel::findMembership(Client* client)
+{
+    MembershipMap::iterator it = _memberships.find(client);
+    return it != _memberships.end() ? &it->second : NULL;
+}
+
+const Channel::Membership* Channel::findMembership(Client* client) const
+{
+    MembershipMap::const_iterator it = _memberships.find(client);
+    return it != _memberships.end() ? &it->second : NULL;
 }
 
 bool Channel::isMember(Client* client) const
 {
-    return std::find(_members.begin(), _members.end(), client) != _members.end();
+    const Membership* entry = findMembership(client);
+    return entry && entry->slot != NOT_MEMBER;
 }
 
-std::vector<Client*> Channel::getMembers() const
+const Channel::MemberList& Channel::getMembers() const
 {
     return (this->_members);
 }
@@ -138,18 +220,22 @@ std::vector<Client*> Channel::getMembers() const
 // Hierarquia de utilizadores
 bool Channel::isOperator(Client *client) const
 {
-    return _operators.find(client) != _operators.end();
+    const Membership* entry = findMembership(client);
+    return entry && (entry->flags & MEMBER_OP);
 }
 
 void Channel::addOperator(Client *client)
 {
-    if (isMember(client))
-        _operators.insert(client);
+    Membership* entry = findMembership(client);
+    if (entry && entry->slot != NOT_MEMBER)
+        entry->flags |= MEMBER_OP;
 }
 
 void Channel::removeOperator(Client *client)
 {
-    _operators.erase(client);
+    Membership* entry = findMembership(client);
+    if (entry)
+        entry->flags &= ~MEMBER_OP;
 }
 
 // Channel modes
@@ -238,17 +324,31 @@ std::string Channel::getModes() const
 // Invite management
 void Channel::addInvite(Client *client)
 {
-    _invitedUsers.insert(client);
+    Membership* entry = findMembership(client);
+    if (!entry)
+    {
+        entry = &_memberships[client];
+        entry->slot = NOT_MEMBER;
+        entry->flags = 0;
+    }
+    entry->flags |= MEMBER_INVITED;
+    client->setInvited(); // so the entry is purged when the client leaves
 }
 
 void Channel::removeInvite(Client *client)
 {
-    _invitedUsers.erase(client);
+    MembershipMap::iterator it = _memberships.find(client);
+    if (it == _memberships.end())
+        return;
+    it->second.flags &= ~MEMBER_INVITED;
+    if (it->second.slot == NOT_MEMBER && it->second.flags == 0)
+        _memberships.erase(it);
 }
 
 bool Channel::isInvited(Client *client) const
 {
-    return _invitedUsers.find(client) != _invitedUsers.end();
+    const Membership* entry = findMembership(client);
+    return entry && (entry->flags & MEMBER_INVITED);
 }
 
 // Permissions
@@ -279,15 +379,16 @@ bool Channel::canJoin(Client *client, const std::string &key) const
 }
 
 // Message
+// The payload is copied once into a shared buffer that every member's
+// output queue references
 void Channel::broadcastMessage(const std::string& message, Client* sender)
 {
-    for (std::vector<Client*>::iterator it = _members.begin(); it != _members.end(); ++it)
-    {
-        if (*it != sender)
-        {
-            (*it)->sendMessage(message);
-        }
-    }
+    broadcastMessage(SharedMessage(new std::string(message)), sender);
+}
+
+void Channel::broadcastMessage(const SharedMessage& message, Client* sender)
+{
+    deliver(message, sender, false);
 }
 
 void Channel::sendMessage(const std::string& message, Client* sender, Client* exclude)
@@ -297,12 +398,102 @@ void Channel::sendMessage(const std::string& message, Client* sender, Client* ex
         return;
     
     // Enviar mensagem para todos os membros exceto o exclude
-    for (std::vector<Client*>::iterator it = _members.begin(); it != _members.end(); ++it)
+    // (chat is the first thing dropped for a member that is falling behind)
+    deliver(SharedMessage(new std::string(message)), exclude, true);
+}
+
+// Fan-out shared by both: a very large channel is split across the fan-out
+// pool when one is running, or else delivered in slices over several loop
+// iterations. Once a channel has a backlog everything sent to it queues
+// behind it, so each member still gets the channel's messages in order.
+void Channel::deliver(const SharedMessage& message, Client* skip, bool relayed)
+{
+    if (_backlog.empty())
+    {
+        if (FanoutPool::covers(_members.size()))
+        {
+            FanoutPool::run(_members, skip, message, relayed);
+            return;
+        }
+        if (_members.size() <= BROADCAST_SLICE)
+        {
+            Broadcast job = { message, skip, relayed, 0, _members.size() };
+            deliverRange(job, 0, _members.size());
+            return;
+        }
+        _backlogged.push_back(this);
+        __sync_fetch_and_add(&_backloggedCount, 1);
+    }
+    // its first slice goes out with the others at the end of this iteration
+    Broadcast job = { message, skip, relayed, 0, _members.size() };
+    _backlog.push_back(job);
+}
+
+void Channel::deliverRange(const Broadcast& job, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++)
+    {
+        Client* member = _members[i];
+        if (member == job.skip)
+            continue;
+        if (job.relayed)
+            member->sendRelayed(job.message);
+        else
+            member->sendMessage(job.message);
+    }
+}
+
+// Delivers up to BROADCAST_SLICE members' worth of the backlog, oldest job
+// first. Returns true once the backlog is empty.
+bool Channel::advanceBacklog()
+{
+    size_t budget = BROADCAST_SLICE;
+    while (budget > 0 && !_backlog.empty())
+    {
+        Broadcast& job = _backlog.front();
+        size_t to = std::min(job.end, job.cursor + budget);
+        deliverRange(job, job.cursor, to);
+        budget -= to - job.cursor;
+        job.cursor = to;
+        if (job.cursor == job.end)
+            _backlog.pop_front();
+    }
+    return _backlog.empty();
+}
+
+// Lock-free check for the event loop (it polls instead of sleeping while
+// some channel still has a backlog)
+bool Channel::hasBacklog()
+{
+    return __sync_fetch_and_add(&_backloggedCount, 0) > 0;
+}
+
+// Delivers everything still queued for the channel at once. Used before a
+// message that reaches the members another way (NICK and QUIT go to peers
+// directly): it must not overtake what was said in the channel before it.
+void Channel::finishBacklog()
+{
+    if (_backlog.empty())
+        return;
+    while (!advanceBacklog())
+        ;
+    _backlogged.erase(std::find(_backlogged.begin(), _backlogged.end(), this));
+    __sync_fetch_and_sub(&_backloggedCount, 1);
+}
+
+// One slice for every channel with a backlog, once per loop iteration
+void Channel::advanceBacklogs()
+{
+    for (size_t i = 0; i < _backlogged.size(); )
     {
-        if (*it != exclude)
+        if (_backlogged[i]->advanceBacklog())
         {
-            (*it)->sendMessage(message);
+            _backlogged[i] = _backlogged.back();
+            _backlogged.pop_back();
+            __sync_fetch_and_sub(&_backloggedCount, 1);
         }
+        else
+            i++;
     }
 }
 
@@ -310,7 +501,7 @@ void Channel::sendMessage(const std::string& message, Client* sender, Client* ex
 std::string Channel::getMemberList() const
 {
     std::string list;
-    for (std::vector<Client*>::const_iterator it = _members.begin(); it != _members.end(); ++it)
+    for (MemberList::const_iterator it = _members.begin(); it != _members.end(); ++it)
     {
         if (!list.empty())
             list += " ";
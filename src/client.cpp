@@ -11,15 +11,23 @@
 /* ************************************************************************** */
 
 #include "client.hpp"
+#include "channel.hpp"
 
 
-Client::Client(int fd) : _clientFd(fd), _authenticated(false)
+static unsigned long g_nextSerial = 0;
+
+Client::Client(int fd, Server *server)
+    : _clientFd(fd), _serial(__sync_add_and_fetch(&g_nextSerial, 1)), _buffStart(0), _buffLen(0), _discardingLine(false), _inputBreaches(0),
+      _inputScheduled(false), _readPaused(false), _floodTokens(FLOOD_BURST * 1000L),
+      _floodStamp(monotonicMs()), _authenticated(false), _dead(false), _invited(false), _fanoutMark(0),
+      _server(server),
+      _outOffset(0), _outBytes(0), _wantWrite(false), _flushScheduled(false),
+      _sendqExceeded(false)
 {
 }
 
 Client::~Client()
 {
-    _channelsList.clear();
     disconnect();
 }
 
@@ -28,32 +36,70 @@ int Client::getFd() const
     return _clientFd;
 }
 
+unsigned long Client::getSerial() const
+{
+    return _serial;
+}
+
 void Client::setNick(const std::string &nickname)
 {
     _nick = nickname;
+    updatePrefix();
 }
 
-std::string Client::getNick() const {
+const std::string& Client::getNick() const {
     return _nick;
 }
 
 void Client::setUser(const std::string &username) 
 {
     _user = username;
+    updatePrefix();
 }
 
-std::string Client::getUser() const
+const std::string& Client::getUser() const
 {
     return _user;
 }
 
-void Client::setShouldQuit(bool shouldQuit)
+// Flags the client for removal; returns false if it already was
+bool Client::markDead(const std::string &reason)
+{
+    if (_dead)
+        return false;
+    _dead = true;
+    _quitReason = reason;
+    return true;
+}
+
+bool Client::isDead() const
+{
+    return _dead;
+}
+
+const std::string& Client::getQuitReason() const
+{
+    return _quitReason;
+}
+
+void Client::setInvited()
+{
+    _invited = true;
+}
+
+bool Client::wasInvited() const
 {
-    _shouldquit = shouldQuit;    
+    return _invited;
 }
-bool Client::getShouldQuit() const
+
+// Returns true the first time a given fan-out reaches this client, so a
+// peer sharing several channels is only sent the message once
+bool Client::markFanout(unsigned long fanout)
 {
-    return _shouldquit;
+    if (_fanoutMark == fanout)
+        return false;
+    _fanoutMark = fanout;
+    return true;
 }
 
 void Client::setPass(const std::string &password) 
@@ -61,7 +107,7 @@ void Client::setPass(const std::string &password)
     _pass = password;
 }
 
-std::string Client::getPass() const
+const std::string& Client::getPass() const
 {
     return _pass;
 }
@@ -69,70 +115,185 @@ std::string Client::getPass() const
 void Client::setHost(const std::string &host)
 {
     _host = host;
+    updatePrefix();
 }
 
-std::string Client::getHost() const
+const std::string& Client::getHost() const
 {
     return _host;
 }
 
-void Client::setCurrChannel(const std::string &channel)
+// Source prefix of everything this client relays. Kept ready so building a
+// message never goes through the nick/user/host getters again.
+void Client::updatePrefix()
+{
+    _prefix.clear();
+    _prefix.reserve(_nick.size() + _user.size() + _host.size() + 3);
+    _prefix += ':';
+    _prefix += _nick;
+    _prefix += '!';
+    _prefix += _user;
+    _prefix += '@';
+    _prefix += _host;
+}
+
+const std::string& Client::getPrefix() const
 {
-    if (!channel.empty())
+    return _prefix;
+}
+
+// "<prefix> <command> <params>\r\n" in a single pre-sized buffer
+std::string Client::relayMessage(const char *command, const std::string &params) const
+{
+    size_t cmdLen = std::strlen(command);
+    std::string message;
+    message.reserve(_prefix.size() + cmdLen + params.size() + 4);
+    message += _prefix;
+    message += ' ';
+    message.append(command, cmdLen);
+    if (!params.empty())
     {
-        addChannel(channel);
+        message += ' ';
+        message += params;
     }
+    message += "\r\n";
+    return message;
 }
 
-std::string Client::getCurrChannel() const
+// Same, with a trailing parameter: "<prefix> <command> <params> :<trailing>\r\n"
+std::string Client::relayMessage(const char *command, const std::string &params,
+    const std::string &trailing) const
 {
-    if (!_channelsList.empty())
+    size_t cmdLen = std::strlen(command);
+    std::string message;
+    message.reserve(_prefix.size() + cmdLen + params.size() + trailing.size() + 7);
+    message += _prefix;
+    message += ' ';
+    message.append(command, cmdLen);
+    if (!params.empty())
     {
-        return _channelsList[0];
+        message += ' ';
+        message += params;
     }
-    return "";
+    message += " :";
+    message += trailing;
+    message += "\r\n";
+    return message;
 }
 
-std::string& Client::getBuffer()
+const char* Client::getBuffer() const
 {
-    return _buff;
+    return _buffLen ? &_buff[_buffStart] : "";
 }
 
-void Client::addChannel(const std::string &channel)
+size_t Client::getBufferSize() const
 {
-    if (std::find(_channelsList.begin(), _channelsList.end(), channel) == _channelsList.end())
-    {
-        _channelsList.push_back(channel);
-    }
+    return _buffLen - _buffStart;
 }
 
-void Client::removeChannel(const std::string &channel)
+// Marks the first len bytes (the lines already handled) as consumed. Nothing
+// is moved: the data is compacted only when recv() needs the room.
+void Client::consumeBuffer(size_t len)
 {
-    std::vector<std::string>::iterator it = std::find(_channelsList.begin(), _channelsList.end(), channel);
-    if (it != _channelsList.end())
-    {
-        _channelsList.erase(it);
-    }
+    _buffStart += std::min(len, _buffLen - _buffStart);
+    if (_buffStart == _buffLen)
+        _buffStart = _buffLen = 0;
 }
 
-bool Client::isInChannel(const std::string &channel) const
+bool Client::isDiscardingLine() const
 {
-    return std::find(_channelsList.begin(), _channelsList.end(), channel) != _channelsList.end();
+    return _discardingLine;
 }
 
-std::vector<std::string> Client::getChannels() const
+void Client::setDiscardingLine(bool discarding)
 {
-    return _channelsList;
+    _discardingLine = discarding;
 }
 
-size_t Client::getChannelCount() const
+unsigned int Client::addInputBreach()
 {
-    return _channelsList.size();
+    return ++_inputBreaches;
 }
 
-void Client::clearChannels()
+bool Client::isInputScheduled() const
 {
-    _channelsList.clear();
+    return _inputScheduled;
+}
+
+void Client::setInputScheduled(bool scheduled)
+{
+    _inputScheduled = scheduled;
+}
+
+// Stops (or resumes) reading from the socket while the input backlog is full
+void Client::setReadPaused(bool paused)
+{
+    if (paused == _readPaused)
+        return;
+    _readPaused = paused;
+    updateEvents();
+}
+
+void Client::updateEvents()
+{
+    _server->watchEvents(_clientFd, !_readPaused, _wantWrite);
+}
+
+// Commands are charged after the fact, so the bucket can go into debt; the
+// client then waits until it is positive again
+void Client::spendFloodTokens(unsigned int cost)
+{
+    _floodTokens -= cost * 1000L;
+}
+
+// Refills the bucket up to now and returns how many ms until the client may
+// run another command (0 = right away)
+unsigned long Client::floodDelay(unsigned long now)
+{
+    const long full = FLOOD_BURST * 1000L;
+    unsigned long elapsed = now - _floodStamp;
+    _floodStamp = now;
+    // FLOOD_RATE tokens per second = FLOOD_RATE thousandths per ms
+    if (elapsed >= static_cast<unsigned long>(full / FLOOD_RATE + 1))
+        _floodTokens = full;
+    else
+        _floodTokens = std::min(full, _floodTokens + static_cast<long>(elapsed) * FLOOD_RATE);
+    if (_floodTokens > 0)
+        return 0;
+    return (-_floodTokens) / FLOOD_RATE + 1;
+}
+
+// Channel side of the link: called by Channel when the client joins. Returns
+// the slot the channel records so unlinking is O(1).
+size_t Client::linkChannel(Channel *channel)
+{
+    _channelsList.push_back(channel);
+    return _channelsList.size() - 1;
+}
+
+// Called by Channel when the client leaves. The last channel moves into the
+// freed slot and is returned so the caller can update its recorded slot.
+Channel* Client::unlinkChannel(size_t slot)
+{
+    Channel* moved = _channelsList.back();
+    _channelsList[slot] = moved;
+    _channelsList.pop_back();
+    return slot < _channelsList.size() ? moved : NULL;
+}
+
+bool Client::isInChannel(Channel *channel) const
+{
+    return channel->isMember(const_cast<Client*>(this));
+}
+
+const std::vector<Channel*>& Client::getChannels() const
+{
+    return _channelsList;
+}
+
+size_t Client::getChannelCount() const
+{
+    return _channelsList.size();
 }
 
 bool Client::isAuthenticated() const
@@ -144,35 +305,279 @@ void Client::authenticate() {
     _authenticated = true;
 }
 
+// Queues the message; nothing is written here. The reactor flushes every
+// client with queued data once per loop iteration, so all the replies a
+// command produces leave in a single syscall. A client of another reactor
+// gets it through that reactor's inbox.
 void Client::sendMessage(const std::string &message)
 {
-    //the flags stop the client from sending SIGPIPE and make the function non-blocking, respectively
-    //i am not sure how this will behave but it sounds like what the subject demands
-    if (send(_clientFd, message.c_str(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) == -1)
+    if (message.empty())
+        return;
+    if (_server->isForeign())
     {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            throw std::runtime_error("Socket send buffer is full, message could not be sent");
-        else
-            throw std::runtime_error("Failed to send message to client: " + std::string(strerror(errno)));
+        _server->post(this, SharedMessage(new std::string(message)), false);
+        return;
     }
+    _server->catchUpInbox();
+    if (_sendqExceeded)
+        return;
+    outputSegment(message.size()) += message;
+    outputQueued(message.size());
 }
 
-std::string Client::receiveMessage()
+// Fan-out variant: the payload is queued by reference, so every recipient
+// of a broadcast points at the same buffer and nothing is allocated per
+// recipient. It is only copied when it fits in the room already reserved
+// in the current segment, which saves an iovec entry for free.
+void Client::sendMessage(const SharedMessage &message)
 {
-    char buffer[512];
-    memset(buffer, 0, sizeof(buffer));
-    int bytesRead = recv(_clientFd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
-    if (bytesRead == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // No data available to read, return an empty string
-            return "";
-        } else {
-            throw std::runtime_error("Failed to receive message from client: " + std::string(strerror(errno)));
+    if (_server->isForeign())
+    {
+        _server->post(this, message, false);
+        return;
+    }
+    _server->catchUpInbox();
+    if (_sendqExceeded)
+        return;
+    if (!_outQueue.empty() && !_outQueue.back().shared)
+    {
+        std::string &segment = _outQueue.back().data;
+        if (segment.size() + message->size() <= std::min(segment.capacity(),
+                static_cast<size_t>(OUT_SEGMENT_SIZE)))
+        {
+            segment += *message;
+            outputQueued(message->size());
+            return;
+        }
+    }
+    _outQueue.push_back(OutSegment());
+    _outQueue.back().shared = message;
+    outputQueued(message->size());
+}
+
+// Same as sendMessage() for a message given in pieces: they are copied
+// straight into the output segment, so no temporary string is built.
+void Client::sendParts(const StringView *parts, size_t count)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += parts[i].size();
+    if (len == 0)
+        return;
+    if (_server->isForeign())
+    {
+        std::string message;
+        message.reserve(len);
+        for (size_t i = 0; i < count; i++)
+            message.append(parts[i].data(), parts[i].size());
+        _server->post(this, SharedMessage(new std::string(message)), false);
+        return;
+    }
+    _server->catchUpInbox();
+    if (_sendqExceeded)
+        return;
+    std::string &segment = outputSegment(len);
+    for (size_t i = 0; i < count; i++)
+        segment.append(parts[i].data(), parts[i].size());
+    outputQueued(len);
+}
+
+// Segment that the next len bytes are appended to. A new segment only
+// reserves what is about to go in and grows like any string when more
+// replies follow: most clients get one short line per flush, and a full
+// OUT_SEGMENT_SIZE up front would be allocated for each of them.
+std::string& Client::outputSegment(size_t len)
+{
+    if (_outQueue.empty() || _outQueue.back().shared
+        || _outQueue.back().data.size() + len > OUT_SEGMENT_SIZE)
+    {
+        _outQueue.push_back(OutSegment());
+        _outQueue.back().data.reserve(len);
+    }
+    return _outQueue.back().data;
+}
+
+void Client::outputQueued(size_t len)
+{
+    _outBytes += len;
+    if (_outBytes > SENDQ_HARD_LIMIT)
+    {
+        // the reactor drops the client on its next flush pass, even if it
+        // is only waiting for EPOLLOUT
+        _sendqExceeded = true;
+        if (!_flushScheduled)
+        {
+            _flushScheduled = true;
+            _server->scheduleFlush(this);
+        }
+        return;
+    }
+    if (!_flushScheduled && !_wantWrite)
+    {
+        _flushScheduled = true;
+        _server->scheduleFlush(this);
+    }
+}
+
+// Gathers the queued segments into one sendmsg() call (writev with
+// MSG_NOSIGNAL). Returns false if the connection is broken; the reactor
+// will notice the error/hangup on the socket and remove the client
+bool Client::flushOutput()
+{
+    _flushScheduled = false;
+    while (_outBytes > 0)
+    {
+        struct iovec iov[OUT_IOV_MAX];
+        size_t count = 0;
+        for (std::deque<OutSegment>::iterator it = _outQueue.begin();
+             it != _outQueue.end() && count < OUT_IOV_MAX; ++it, ++count)
+        {
+            const std::string &bytes = it->bytes();
+            size_t skip = (count == 0) ? _outOffset : 0;
+            iov[count].iov_base = const_cast<char *>(bytes.data() + skip);
+            iov[count].iov_len = bytes.size() - skip;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        //the flags stop the client from sending SIGPIPE and make the function non-blocking, respectively
+        ssize_t sent = sendmsg(_clientFd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            _outQueue.clear();
+            _outOffset = 0;
+            _outBytes = 0;
+            return false;
+        }
+        _outBytes -= sent;
+        size_t done = sent + _outOffset;
+        while (!_outQueue.empty() && done >= _outQueue.front().bytes().size())
+        {
+            done -= _outQueue.front().bytes().size();
+            _outQueue.pop_front();
+        }
+        _outOffset = done;
+    }
+    bool pending = hasPendingOutput();
+    if (pending != _wantWrite)
+    {
+        _wantWrite = pending;
+        updateEvents();
+    }
+    return true;
+}
+
+bool Client::hasPendingOutput() const
+{
+    return _outBytes > 0;
+}
+
+size_t Client::getOutBytes() const
+{
+    return _outBytes;
+}
+
+// Past the soft limit the client is falling behind: non-essential traffic
+// (relayed chat) is no longer queued for it
+bool Client::isSendQThrottled() const
+{
+    return _outBytes >= SENDQ_SOFT_LIMIT;
+}
+
+// Relayed chat: given up while the client is throttled. For a client of
+// another reactor the check is made by its owner, which reads the queue.
+void Client::sendRelayed(const std::string &message)
+{
+    if (_server->isForeign())
+    {
+        _server->post(this, SharedMessage(new std::string(message)), true);
+        return;
+    }
+    // earlier posts count towards the throttle
+    _server->catchUpInbox();
+    if (!isSendQThrottled())
+        sendMessage(message);
+}
+
+void Client::sendRelayed(const SharedMessage &message)
+{
+    if (_server->isForeign())
+    {
+        _server->post(this, message, true);
+        return;
+    }
+    _server->catchUpInbox();
+    if (!isSendQThrottled())
+        sendMessage(message);
+}
+
+bool Client::isSendQExceeded() const
+{
+    return _sendqExceeded;
+}
+
+// Throws the queue away and makes one non-blocking attempt to send a last
+// line. If a line was cut short, "\r\n" is sent first: that closes the
+// fragment, which the client still reads as a (truncated) message of its
+// own, but the last line then starts on a line of its own and parses.
+void Client::abortOutput(const std::string &line)
+{
+    std::string last = _outOffset > 0 ? "\r\n" + line : line;
+    _outQueue.clear();
+    _outOffset = 0;
+    _outBytes = 0;
+    send(_clientFd, last.data(), last.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+// Reads what the socket has (up to INPUT_BUFFER_CAP pending) straight into
+// the input buffer and returns the number of bytes added. Throws when the
+// peer is gone.
+size_t Client::receiveMessage()
+{
+    size_t total = 0;
+    while (true)
+    {
+        if (_buff.size() - _buffLen < RECV_CHUNK_SIZE && _buffStart > 0)
+        {
+            // move the pending partial line to the front
+            memmove(&_buff[0], &_buff[_buffStart], _buffLen - _buffStart);
+            _buffLen -= _buffStart;
+            _buffStart = 0;
+        }
+        if (_buff.size() - _buffLen < RECV_CHUNK_SIZE)
+            _buff.resize(_buffLen + RECV_CHUNK_SIZE);
+        size_t room = _buff.size() - _buffLen;
+        ssize_t bytesRead = recv(_clientFd, &_buff[_buffLen], room, MSG_DONTWAIT);
+        if (bytesRead > 0)
+        {
+            _buffLen += bytesRead;
+            total += bytesRead;
+            // a short read means the socket is drained, skip the EAGAIN round trip
+            if (static_cast<size_t>(bytesRead) < room)
+                break;
+            // enough queued for now; the rest stays in the socket until the
+            // backlog is worked off
+            if (_buffLen - _buffStart >= INPUT_BUFFER_CAP)
+                break;
+            continue;
         }
-    } else if (bytesRead == 0) {
-        throw std::runtime_error("Client disconnected");
+        if (bytesRead == -1 && errno == EINTR)
+            continue;
+        if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        // close/error after data: handle the lines first, the next wake-up reports it
+        if (total > 0)
+            break;
+        if (bytesRead == 0)
+            throw std::runtime_error("Client disconnected");
+        throw std::runtime_error("Failed to receive message from client: " + std::string(strerror(errno)));
     }
-    return std::string(buffer, bytesRead);
+    return total;
 }
 
 void Client::disconnect() {
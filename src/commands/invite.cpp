@@ -17,8 +17,8 @@
 /**
  * @brief INVITE - Invite a user to a channel
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Target nickname and channel name
+ * @param client Client sending the command
+ * @param msg Parsed message: target nickname and channel name
  * 
  * @details Invites a user to a channel. If the channel is invite-only (+i), only
  *          channel operators can send invites. The invited user will be able to
@@ -45,66 +45,42 @@
  * - INVITE Bob #meeting
  */
 
-void Server::inviteCommand(int client_fd, const std::string& params)
+void Server::inviteCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client || !client->isAuthenticated())
-    {
-        if (client)
-            client->sendMessage(":irc.local 451 * :You have not registered\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string target_nick, channel_name;
-    iss >> target_nick >> channel_name;
-    if (target_nick.empty() || channel_name.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "INVITE") + "\r\n");
-        return;
-    }
+    std::string target_nick = msg.param(0).str();
+    std::string channel_name = msg.param(1).str();
     std::map<std::string, Channel*>::iterator chan_it = _channels.find(channel_name);
     if (chan_it == _channels.end())
     {
-        client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNoSuchChannel(client, channel_name);
         return;
     }
 
     Channel* channel = chan_it->second;
     if (!channel->isMember(client))
     {
-        client->sendMessage(ERR_NOTONCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNotOnChannel(client, channel_name);
         return;
     }
     if (channel->getMode('i') && !channel->isOperator(client))
     {
-        client->sendMessage(ERR_CHANOPRIVSNEEDED(client->getNick(), channel_name) + "\r\n");
+        errChanOPrivsNeeded(client, channel_name);
         return;
     }
-    Client* target = NULL;
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-    {
-        if ((*it)->getNick() == target_nick)
-        {
-            target = *it;
-            break;
-        }
-    }
+    Client* target = getClientByNick(target_nick);
     if (!target)
     {
-        client->sendMessage(ERR_NOSUCHNICK(client->getNick(), target_nick) + "\r\n");
+        errNoSuchNick(client, target_nick);
         return;
     }
     if (channel->isMember(target))
     {
-        client->sendMessage(ERR_USERONCHANNEL(client->getNick(), target_nick, channel_name) + "\r\n");
+        errUserOnChannel(client, target_nick, channel_name);
         return;
     }
     channel->addInvite(target);
-    client->sendMessage(RPL_INVITING(client->getNick(), target_nick, channel_name) + "\r\n");
-    std::string invite_msg = ":" + client->getNick() + "!" + client->getUser() 
-                           + "@localhost INVITE " + target_nick + " " + channel_name + "\r\n";
-    target->sendMessage(invite_msg);
-    std::cout << client->getNick() << " invited " << target_nick 
-              << " to " << channel_name << std::endl;
+    rplInviting(client, target_nick, channel_name);
+    target->sendMessage(client->relayMessage("INVITE", target_nick + " " + channel_name));
+    LOG_INFO(LOG_CHANNEL) << client->getNick() << " invited " << target_nick 
+              << " to " << channel_name;
 }
\ No newline at end of file
@@ -17,8 +17,8 @@
 /**
  * @brief JOIN - Join one or more channels
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Channel names (comma-separated) and optional keys (comma-separated)
+ * @param client Client sending the command
+ * @param msg Parsed message: channel names (comma-separated) and optional keys (comma-separated)
  * 
  * @details Makes the client join the specified channels. If the channel doesn't exist,
  *          it will be created and the client will become the channel operator. Multiple
@@ -47,54 +47,25 @@
  */
 
 
-void Server::joinCommand(int client_fd, const std::string &params)
+void Server::joinCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client)
-        return;
-        
-   if (!client->isAuthenticated())
-    {
-        client->sendMessage(ERR_NOTREGISTERED(client->getNick()) + "\r\n");
-        return;
-    }
-    if (params.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "JOIN") + "\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string chName, chPassword;
-    iss >> chName >> chPassword;
-    std::vector<std::string> channels;
-    std::vector<std::string> keys;
-    std::stringstream channel_stream(chName);
-    std::string channel;
+    const StringView &channels = msg.params[0];
+    const StringView &keys = msg.param(1);
+    size_t channel_pos = 0;
+    size_t key_pos = 0;
+    StringView item;
     
-    while (std::getline(channel_stream, channel, ','))
+    while (nextListItem(channels, channel_pos, item))
     {
-        if (!channel.empty())
-            channels.push_back(channel);
-    }
-    
-    if (!chPassword.empty())
-    {
-        std::stringstream key_stream(chPassword);
+        if (item.empty())
+            continue;
+        std::string chan_name = item.str();
         std::string key;
-        while (std::getline(key_stream, key, ','))
-        {
-            keys.push_back(key);
-        }
-    }
-    
-    for (size_t i = 0; i < channels.size(); ++i)
-    {
-        std::string chan_name = channels[i];
-        std::string key = (i < keys.size()) ? keys[i] : "";
+        if (nextListItem(keys, key_pos, item))
+            key = item.str();
         if (chan_name.empty() || (chan_name[0] != '#' && chan_name[0] != '&'))
         {
-            client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), chan_name) + "\r\n");
+            errNoSuchChannel(client, chan_name);
             continue;
         }
         Channel* channel = NULL;
@@ -112,15 +83,15 @@ void Server::joinCommand(int client_fd, const std::string &params)
             {
                 if (channel->getMode('i') && !channel->isInvited(client))
                 {
-                    client->sendMessage(ERR_INVITEONLYCHAN(client->getNick(), chan_name) + "\r\n");
+                    errInviteOnlyChan(client, chan_name);
                 }
                 else if (channel->getMode('k') && key != channel->getKey())
                 {
-                    client->sendMessage(ERR_BADCHANNELKEY(client->getNick(), chan_name) + "\r\n");
+                    errBadChannelKey(client, chan_name);
                 }
                 else if (channel->getMode('l') && channel->getMemberCount() >= channel->getUserLimit())
                 {
-                    client->sendMessage(ERR_CHANNELISFULL(client->getNick(), chan_name) + "\r\n");
+                    errChannelIsFull(client, chan_name);
                 }
                 continue;
             }
@@ -134,27 +105,28 @@ void Server::joinCommand(int client_fd, const std::string &params)
         {
             channel = new Channel(chan_name, client);
             _channels[chan_name] = channel;
-            std::cout << "Created new channel: " << chan_name 
-                      << " by " << client->getNick() << std::endl;
+            LOG_INFO(LOG_CHANNEL) << "Created new channel: " << chan_name 
+                      << " by " << client->getNick();
         }
-        std::string join_msg = ":" + client->getNick() + "!" + client->getUser() 
-                             + "@localhost JOIN " + chan_name + "\r\n";
-        channel->broadcastMessage(join_msg);
+        // the joiner's own JOIN goes out first, ahead of the names reply; a
+        // new member is not owed anything still being delivered to the channel
+        std::string join_msg = client->relayMessage("JOIN", chan_name);
+        client->sendMessage(join_msg);
+        channel->broadcastMessage(join_msg, client);
         if (!channel->getTopic().empty())
         {
-            client->sendMessage(RPL_TOPIC(client->getNick(), chan_name, channel->getTopic()) + "\r\n");
+            rplTopic(client, chan_name, channel->getTopic());
         }
         else
         {
-            client->sendMessage(RPL_NOTOPIC(client->getNick(), chan_name) + "\r\n");
+            rplNoTopic(client, chan_name);
         }
 
         std::string member_list = channel->getMemberList();
-        client->sendMessage(RPL_NAMREPLY(client->getNick(), chan_name, member_list) + "\r\n");
-        client->sendMessage(RPL_ENDOFNAMES(client->getNick(), chan_name) + "\r\n");
+        rplNamReply(client, chan_name, member_list);
+        rplEndOfNames(client, chan_name);
         
-        client->addChannel(chName);        
-        std::cout << "Client " << client->getNick() 
-                  << " joined channel " << chan_name << std::endl;
+        LOG_INFO(LOG_CHANNEL) << "Client " << client->getNick() 
+                  << " joined channel " << chan_name;
     }
 }
\ No newline at end of file
@@ -17,8 +17,8 @@
 /**
  * @brief KICK - Forcibly remove a user from a channel
  * 
- * @param client_fd File descriptor of the client sending the command (must be channel op)
- * @param params Channel name, target nickname, and optional kick reason
+ * @param client Client sending the command (must be channel op)
+ * @param msg Parsed message: channel name, target nickname, and optional kick reason
  * 
  * @details Forcibly removes a user from a channel. This command can only be used by
  *          channel operators. The kicked user will receive a KICK message and be
@@ -44,84 +44,45 @@
  * - KICK #chat spammer :Spamming is not allowed
  */
 
-void Server::kickCommand(int client_fd, const std::string &params)
+void Server::kickCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client || !client->isAuthenticated())
-    {
-        if (client)
-            client->sendMessage(":irc.local 451 * :You have not registered\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string channel_name, target_nick, reason;
-    
-    iss >> channel_name >> target_nick;
-    if (channel_name.empty() || target_nick.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "KICK") + "\r\n");
-        return;
-    }
-    
-    size_t reason_pos = params.find(" :");
-    if (reason_pos != std::string::npos)
-    {
-        reason = params.substr(reason_pos + 2);
-    }
-    else
-    {
-        std::string temp;
-        std::getline(iss, temp);
-        if (!temp.empty() && temp[0] == ' ')
-            reason = temp.substr(1);
-    }
-    
+    std::string channel_name = msg.param(0).str();
+    std::string target_nick = msg.param(1).str();
+    std::string reason = msg.param(2).str();
     if (reason.empty())
         reason = client->getNick();
     std::map<std::string, Channel*>::iterator chan_it = _channels.find(channel_name);
     if (chan_it == _channels.end())
     {
-        client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNoSuchChannel(client, channel_name);
         return;
     }
     
     Channel* channel = chan_it->second;
     if (!channel->isMember(client))
     {
-        client->sendMessage(ERR_NOTONCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNotOnChannel(client, channel_name);
         return;
     }
     if (!channel->isOperator(client))
     {
-        client->sendMessage(ERR_CHANOPRIVSNEEDED(client->getNick(), channel_name) + "\r\n");
+        errChanOPrivsNeeded(client, channel_name);
         return;
     }
     
-    Client* target = NULL;
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-    {
-        if ((*it)->getNick() == target_nick)
-        {
-            target = *it;
-            break;
-        }
-    }
+    Client* target = getClientByNick(target_nick);
     if (!target || !channel->isMember(target))
     {
-        client->sendMessage(ERR_USERNOTINCHANNEL(client->getNick(), target_nick, channel_name) + "\r\n");
+        errUserNotInChannel(client, target_nick, channel_name);
         return;
     }
     
-    std::string kick_msg = ":" + client->getNick() + "!" + client->getUser() 
-                         + "@localhost KICK " + channel_name + " " + target_nick 
-                         + " :" + reason + "\r\n";
+    std::string kick_msg = client->relayMessage("KICK", channel_name + " " + target_nick, reason);
     
     channel->broadcastMessage(kick_msg);
     channel->removeMember(target);
-    target->removeChannel(channel_name);
-    std::cout << client->getNick() << " kicked " << target_nick 
-              << " from " << channel_name << " (" << reason << ")" << std::endl;
+    LOG_INFO(LOG_CHANNEL) << client->getNick() << " kicked " << target_nick 
+              << " from " << channel_name << " (" << reason << ")";
     
     if (channel->getMemberCount() == 0)
     {
@@ -17,8 +17,8 @@
 /**
  * @brief MODE - Change channel or user modes
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Target (channel/user), mode changes, and mode parameters
+ * @param client Client sending the command
+ * @param msg Parsed message: target (channel/user), mode changes, and mode parameters
  * 
  * @details Sets or removes modes on channels or users. Channel modes control channel
  *          behavior and access. This implementation focuses on channel modes.
@@ -51,24 +51,11 @@
  * - MODE #channel -i+m
  */
 
-void Server::modeCommand(int client_fd, const std::string &params)
+void Server::modeCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client || !client->isAuthenticated())
-    {
-        if (client)
-            client->sendMessage(":irc.local 451 * :You have not registered\r\n");
-        return;
-    }
-    std::istringstream iss(params);
-    std::string target, modes_str;
-    iss >> target >> modes_str;    
-    if (target.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "MODE") + "\r\n");
-        return;
-    }
-    if (target[0] != '#' && target[0] != '&')
+    std::string target = msg.param(0).str();
+    std::string modes_str = msg.param(1).str();
+    if (target.empty() || (target[0] != '#' && target[0] != '&'))
     {
         return;
     }
@@ -76,31 +63,26 @@ void Server::modeCommand(int client_fd, const std::string &params)
     std::map<std::string, Channel*>::iterator chan_it = _channels.find(target);
     if (chan_it == _channels.end())
     {
-        client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), target) + "\r\n");
+        errNoSuchChannel(client, target);
         return;
     }
     Channel* channel = chan_it->second;
     if (modes_str.empty())
     {
-        client->sendMessage(RPL_CHANNELMODEIS(client->getNick(), target, channel->getModes()) + "\r\n");
+        rplChannelModeIs(client, target, channel->getModes());
         return;
     }
     
     if (!channel->isOperator(client))
     {
-        client->sendMessage(ERR_CHANOPRIVSNEEDED(client->getNick(), target) + "\r\n");
+        errChanOPrivsNeeded(client, target);
         return;
     }
     bool adding = true;
     std::string mode_changes;
     std::string mode_params;
-    std::vector<std::string> params_list;
-    std::string param;
-    while (iss >> param)
-    {
-        params_list.push_back(param);
-    }
-    size_t param_index = 0;
+    // mode arguments follow the mode string
+    size_t param_index = 2;
     for (size_t i = 0; i < modes_str.length(); ++i)
     {
         char mode = modes_str[i];
@@ -134,11 +116,11 @@ void Server::modeCommand(int client_fd, const std::string &params)
                 case 'k': // channel key
                     if (adding)
                     {
-                        if (param_index < params_list.size())
+                        if (param_index < msg.paramCount)
                         {
-                            channel->setChannelKey(params_list[param_index]);
+                            channel->setChannelKey(msg.params[param_index].str());
                             mode_changes += mode;
-                            mode_params += " " + params_list[param_index];
+                            mode_params += " " + msg.params[param_index].str();
                             param_index++;
                             mode_changed = true;
                         }
@@ -152,18 +134,9 @@ void Server::modeCommand(int client_fd, const std::string &params)
                     break;
                     
                 case 'o': // operator status
-                    if (param_index < params_list.size())
+                    if (param_index < msg.paramCount)
                     {
-                        Client* target_client = NULL;
-                        for (std::vector<Client*>::iterator it = _clients.begin(); 
-                             it != _clients.end(); ++it)
-                        {
-                            if ((*it)->getNick() == params_list[param_index])
-                            {
-                                target_client = *it;
-                                break;
-                            }
-                        }
+                        Client* target_client = getClientByNick(msg.params[param_index].str());
                         
                         if (target_client && channel->isMember(target_client))
                         {
@@ -173,7 +146,7 @@ void Server::modeCommand(int client_fd, const std::string &params)
                                 channel->removeOperator(target_client);
                             
                             mode_changes += mode;
-                            mode_params += " " + params_list[param_index];
+                            mode_params += " " + msg.params[param_index].str();
                             mode_changed = true;
                         }
                         param_index++;
@@ -182,15 +155,15 @@ void Server::modeCommand(int client_fd, const std::string &params)
                 case 'l': // user limit
                     if (adding)
                     {
-                        if (param_index < params_list.size())
+                        if (param_index < msg.paramCount)
                         {
-                            std::istringstream limit_iss(params_list[param_index]);
+                            std::istringstream limit_iss(msg.params[param_index].str());
                             size_t limit;
                             if (limit_iss >> limit)
                             {
                                 channel->setUserLimit(limit);
                                 mode_changes += mode;
-                                mode_params += " " + params_list[param_index];
+                                mode_params += " " + msg.params[param_index].str();
                                 mode_changed = true;
                             }
                             param_index++;
@@ -205,19 +178,17 @@ void Server::modeCommand(int client_fd, const std::string &params)
                     break;
                     
                 default:
-                    client->sendMessage(ERR_UNKNOWNMODE(client->getNick(), 
-                                      std::string(1, mode), target) + "\r\n");
+                    errUnknownMode(client, mode, target);
                     break;
             }
         }
     }
     if (!mode_changes.empty() && mode_changes != "+-")
     {
-        std::string mode_msg = ":" + client->getNick() + "!" + client->getUser() 
-                             + "@localhost MODE " + target + " " + mode_changes + mode_params + "\r\n";
+        std::string mode_msg = client->relayMessage("MODE", target + " " + mode_changes + mode_params);
         channel->broadcastMessage(mode_msg);
         
-        std::cout << client->getNick() << " set modes " << mode_changes 
-                  << mode_params << " on " << target << std::endl;
+        LOG_INFO(LOG_CHANNEL) << client->getNick() << " set modes " << mode_changes 
+                  << mode_params << " on " << target;
     }
 }
\ No newline at end of file
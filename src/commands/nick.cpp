@@ -19,8 +19,8 @@
 /**
  * @brief NICK - Nickname command to set or change client nickname
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Desired nickname (max 9 characters)
+ * @param client Client sending the command
+ * @param msg Parsed message: desired nickname (max 9 characters)
  * 
  * @details Used to give the client a nickname or change the previous one. The nickname
  *          must be unique on the server. If the client is already registered, changing
@@ -57,26 +57,19 @@ bool isValidNickChar(char c, bool first_char)
            c == '{' || c == '}' || c == '\\' || c == '|' || c == '_' || c == '^';
 }
 
-void Server::nickCommand(int client_fd, const std::string& params)
+void Server::nickCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client)
-        return;
-    if (params.empty())
+    if (msg.paramCount < 1 || msg.params[0].empty())
     {
-        std::string current = client->getNick().empty() ? "*" : client->getNick();
-        client->sendMessage(ERR_NONICKNAMEGIVEN(current) + "\r\n");
+        errNoNicknameGiven(client);
         return;
     }
-    std::istringstream iss(params);
-    std::string new_nick;
-    iss >> new_nick;
+    std::string new_nick = msg.params[0].str();
     
     std::string old_nick = client->getNick();
-    std::string display_nick = old_nick.empty() ? "*" : old_nick;
     if (new_nick.length() > 9)
     {
-        client->sendMessage(ERR_ERRONEUSNICKNAME(display_nick, new_nick) + "\r\n");
+        errErroneusNickname(client, new_nick);
         return;
     }
     
@@ -84,89 +77,65 @@ void Server::nickCommand(int client_fd, const std::string& params)
     {
         if (!isValidNickChar(new_nick[i], i == 0))
         {
-            client->sendMessage(ERR_ERRONEUSNICKNAME(display_nick, new_nick) + "\r\n");
+            errErroneusNickname(client, new_nick);
             return;
         }
     }
     if (std::isdigit(new_nick[0]))
     {
-        client->sendMessage(ERR_ERRONEUSNICKNAME(display_nick, new_nick) + "\r\n");
+        errErroneusNickname(client, new_nick);
         return;
     }
     if (new_nick == old_nick)
     {
         return;
     }
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+    Client* holder = getClientByNick(new_nick);
+    if (holder && holder != client)
     {
-        if (*it != client && (*it)->getNick() == new_nick)
-        {
-            client->sendMessage(ERR_NICKNAMEINUSE(display_nick, new_nick) + "\r\n");
-            return;
-        }
+        errNicknameInUse(client, new_nick);
+        return;
     }
     
     if (client->isAuthenticated() && !old_nick.empty())
     {
-        std::string nick_change_msg = ":" + old_nick + "!" + client->getUser() 
-                                    + "@localhost NICK :" + new_nick + "\r\n";
+        // built before setNick() so it carries the old prefix
+        SharedMessage nick_change_msg(new std::string(client->relayMessage("NICK", "", new_nick)));
         
-        client->sendMessage(nick_change_msg);
+        // after the peers: sendToPeers() first completes what is still
+        // queued in our channels, for us as well
+        sendToPeers(client, nick_change_msg);
         
-        std::set<Client*> clients_to_notify;
-        std::vector<std::string> channels = client->getChannels();
-        for (std::vector<std::string>::const_iterator chan_it = channels.begin();
-             chan_it != channels.end(); ++chan_it)
-        {
-            std::map<std::string, Channel*>::iterator channel_it = _channels.find(*chan_it);
-            if (channel_it != _channels.end())
-            {
-                std::vector<Client*> members = channel_it->second->getMembers();
-                for (std::vector<Client*>::const_iterator member_it = members.begin();
-                     member_it != members.end(); ++member_it)
-                {
-                    if (*member_it != client)
-                    {
-                        clients_to_notify.insert(*member_it);
-                    }
-                }
-            }
-        }
-        for (std::set<Client*>::iterator it = clients_to_notify.begin();
-             it != clients_to_notify.end(); ++it)
-        {
-            (*it)->sendMessage(nick_change_msg);
-        }
+        client->sendMessage(nick_change_msg);
         
-        std::cout << "Client " << old_nick << " changed nickname to " << new_nick << std::endl;
+        LOG_INFO(LOG_CLIENT) << "Client " << old_nick << " changed nickname to " << new_nick;
     }
     
+    if (!old_nick.empty())
+        _nicks.erase(old_nick);
     client->setNick(new_nick);
+    _nicks[new_nick] = client;
     if (!client->isAuthenticated())
     {
         if (!client->getNick().empty() && !client->getUser().empty())
         {
             if (client->getPass().empty())
             {
-                std::cout << "Client " << client->getNick() 
-                          << " missing password for authentication" << std::endl;
+                LOG_WARN(LOG_CLIENT) << "Client " << client->getNick() 
+                          << " missing password for authentication";
             }
             else if (client->getPass() != _pass)
             {
-                std::cout << "Client " << client->getNick() 
-                          << " provided incorrect password" << std::endl;
-                client->sendMessage(":irc.local 464 " + client->getNick() 
-                                  + " :Password incorrect\r\n");
+                LOG_WARN(LOG_CLIENT) << "Client " << client->getNick() 
+                          << " provided incorrect password";
+                errPasswdMismatch(client);
             }
             else
             {
                 client->authenticate();
-                std::string welcome = ":irc.local 001 " + client->getNick() 
-                                    + " :Welcome to the IRC Network " + client->getNick() 
-                                    + "!" + client->getUser() + "@localhost\r\n";
-                client->sendMessage(welcome);              
-                std::cout << "Client authenticated successfully: " << client->getNick() 
-                          << " (" << client->getUser() << ") from fd " << client_fd << std::endl;
+                rplWelcome(client);              
+                LOG_INFO(LOG_CLIENT) << "Client authenticated successfully: " << client->getNick() 
+                          << " (" << client->getUser() << ") from fd " << client->getFd();
             }
         }
     }
@@ -17,8 +17,8 @@
 /**
  * @brief PART - Leave one or more channels
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Channel names (comma-separated) and optional part message
+ * @param client Client sending the command
+ * @param msg Parsed message: channel names (comma-separated) and optional part message
  * 
  * @details Removes the client from the specified channels. An optional part message
  *          can be included which will be sent to all channel members. If the channel
@@ -42,84 +42,50 @@
  * - PART #chan1,#chan2 :Goodbye everyone!
  */
 
-void Server::partCommand(int client_fd, const std::string &params)
+void Server::partCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client) return;
-    
-    if (!client->isAuthenticated())
-    {
-        client->sendMessage(ERR_NOTREGISTERED(client->getNick()) + "\r\n");
-        return;
-    }
-    if (params.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "PART") + "\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string channels_str;
-    std::string part_message;
-    
-    iss >> channels_str;
-    
-    // Procura se tem mensagem de saída (:) (opcional)
-    size_t msg_pos = params.find(" :");
-    if (msg_pos != std::string::npos)
-    {
-        part_message = params.substr(msg_pos + 2);
-    }
-    else
-    {
-        std::getline(iss, part_message);
-        size_t first_char = part_message.find_first_not_of(" \t");
-        if (first_char != std::string::npos)
-            part_message = part_message.substr(first_char);
-    }
-    
+    // Mensagem de saída (opcional)
+    std::string part_message = msg.param(1).str();
     if (part_message.empty())
         part_message = client->getNick();
     
-    std::stringstream channel_stream(channels_str);
-    std::string channel_name;
+    const StringView &channels = msg.params[0];
+    size_t channel_pos = 0;
+    StringView item;
     
-    while (std::getline(channel_stream, channel_name, ','))
+    while (nextListItem(channels, channel_pos, item))
     {
-        if (channel_name.empty())
+        if (item.empty())
             continue;
+        std::string channel_name = item.str();
         
         std::map<std::string, Channel*>::iterator it = _channels.find(channel_name);
         if (it == _channels.end())
         {
-            client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), channel_name) + "\r\n");
+            errNoSuchChannel(client, channel_name);
             continue;
         }
         Channel* channel = it->second;
     
         if (!channel->isMember(client))
         {
-            client->sendMessage(ERR_NOTONCHANNEL(client->getNick(), channel_name) + "\r\n");
+            errNotOnChannel(client, channel_name);
             continue;
         }
         
-        std::string part_msg = ":" + client->getNick() + "!" + client->getUser() 
-                             + "@localhost PART " + channel_name;
-        if (!part_message.empty())
-            part_msg += " :" + part_message;
-        part_msg += "\r\n";
-        
-        channel->broadcastMessage(part_msg);   
+        if (part_message.empty())
+            channel->broadcastMessage(client->relayMessage("PART", channel_name));
+        else
+            channel->broadcastMessage(client->relayMessage("PART", channel_name, part_message));   
         channel->removeMember(client);
-        client->removeChannel(channel_name);
         
-        std::cout << "Client " << client->getNick() 
+        LOG_INFO(LOG_CHANNEL) << "Client " << client->getNick() 
                   << " left channel " << channel_name 
-                  << " (" << part_message << ")" << std::endl;
+                  << " (" << part_message << ")";
         
         if (channel->getMemberCount() == 0)
         {
-            std::cout << "Channel " << channel_name << " is now empty, removing..." << std::endl;
+            LOG_INFO(LOG_CHANNEL) << "Channel " << channel_name << " is now empty, removing...";
             delete channel;
             _channels.erase(it);
         }
@@ -17,8 +17,8 @@
 /**
  * @brief PASS - Password command for server authentication
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Password string to authenticate with the server
+ * @param client Client sending the command
+ * @param msg Parsed message: password string to authenticate with the server
  * 
  * @details This command is used to set a connection password. The password must be
  *          set before the NICK/USER registration is completed. Once a client is
@@ -35,21 +35,13 @@
  * - PASS myserverpass123
  */
 
-void Server::passCommand(int client_fd, const std::string &params)
+void Server::passCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client)
-        return;
     if (client->isAuthenticated())
     {
-        client->sendMessage(ERR_ALREADYREGISTRED(client->getNick()) + "\r\n");
-        return;
-    }
-    if (params.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "PASS") + "\r\n");
+        errAlreadyRegistred(client);
         return;
     }
-    client->setPass(params);
-    std::cout << "Password set for client fd: " << client_fd << std::endl;
+    client->setPass(msg.params[0].str());
+    LOG_DEBUG(LOG_CLIENT) << "Password set for client fd: " << client->getFd();
 }
\ No newline at end of file
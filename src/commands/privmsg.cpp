@@ -17,8 +17,8 @@
 /**
  * @brief PRIVMSG - Send private message to user or channel
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Target (nickname or channel) and message text
+ * @param client Client sending the command
+ * @param msg Parsed message: target (nickname or channel) and message text
  * 
  * @details Sends a message to a user or channel. For channels, the sender must be
  *          a member of the channel to send messages. The message is not echoed back
@@ -44,92 +44,56 @@
  * - PRIVMSG #help :Can someone help me?
  */
 
-void Server::privmsgCommand(int client_fd, const std::string &params)
+void Server::privmsgCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client || !client->isAuthenticated())
+    if (msg.paramCount < 1 || msg.params[0].empty())
     {
-        if (client)
-            client->sendMessage(":irc.local 451 * :You have not registered\r\n");
+        errNoRecipient(client, "PRIVMSG");
         return;
     }
-    if (params.empty())
+    if (msg.paramCount < 2 || msg.params[1].empty())
     {
-        client->sendMessage(ERR_NORECIPIENT(client->getNick(), "PRIVMSG") + "\r\n");
+        errNoTextToSend(client);
         return;
     }
     
-    size_t msg_pos = params.find(" :");
-    if (msg_pos == std::string::npos)
-    {
-        client->sendMessage(ERR_NOTEXTTOSEND(client->getNick()) + "\r\n");
-        return;
-    }
-    
-    std::string target = params.substr(0, msg_pos);
-    std::string message = params.substr(msg_pos + 2);
-    
-    size_t first_non_space = target.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos)
-        target = target.substr(first_non_space);
-    size_t last_non_space = target.find_last_not_of(" \t");
-    if (last_non_space != std::string::npos)
-        target = target.substr(0, last_non_space + 1);
-    if (target.empty())
-    {
-        client->sendMessage(ERR_NORECIPIENT(client->getNick(), "PRIVMSG") + "\r\n");
-        return;
-    }    
-    if (message.empty())
-    {
-        client->sendMessage(ERR_NOTEXTTOSEND(client->getNick()) + "\r\n");
-        return;
-    }
+    std::string target = msg.params[0].str();
+    std::string message = msg.params[1].str();
     
-    std::string privmsg = ":" + client->getNick() + "!" + client->getUser() 
-                        + "@localhost PRIVMSG " + target + " :" + message + "\r\n";
+    std::string privmsg = client->relayMessage("PRIVMSG", target, message);
     
     if (target[0] == '#' || target[0] == '&')
     {
         std::map<std::string, Channel*>::iterator chan_it = _channels.find(target);
         if (chan_it == _channels.end())
         {
-            client->sendMessage(ERR_NOSUCHNICK(client->getNick(), target) + "\r\n");
+            errNoSuchNick(client, target);
             return;
         }
         
         Channel* channel = chan_it->second;
         if (!channel->canSendMessage(client))
         {
-            client->sendMessage(ERR_CANNOTSENDTOCHAN(client->getNick(), target) + "\r\n");
+            errCannotSendToChan(client, target);
             return;
         }
         channel->sendMessage(privmsg, client, client);
         
-        std::cout << client->getNick() << " sent message to " << target 
-                  << ": " << message << std::endl;
+        LOG_DEBUG(LOG_COMMAND) << client->getNick() << " sent message to " << target 
+                  << ": " << message;
     }
     else
     {
-        Client* target_client = NULL;
-        for (std::vector<Client*>::iterator it = _clients.begin(); 
-             it != _clients.end(); ++it)
-        {
-            if ((*it)->getNick() == target)
-            {
-                target_client = *it;
-                break;
-            }
-        }
+        Client* target_client = getClientByNick(target);
         
         if (!target_client)
         {
-            client->sendMessage(ERR_NOSUCHNICK(client->getNick(), target) + "\r\n");
+            errNoSuchNick(client, target);
             return;
         }
-        target_client->sendMessage(privmsg);
+        target_client->sendRelayed(privmsg);
         
-        std::cout << client->getNick() << " sent private message to " 
-                  << target << ": " << message << std::endl;
+        LOG_DEBUG(LOG_COMMAND) << client->getNick() << " sent private message to " 
+                  << target << ": " << message;
     }
 }
\ No newline at end of file
@@ -17,8 +17,8 @@
 /**
  * @brief TOPIC - View or change channel topic
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Channel name and optional new topic
+ * @param client Client sending the command
+ * @param msg Parsed message: channel name and optional new topic
  * 
  * @details Without a new topic, shows the current channel topic. With a new topic,
  *          sets the channel topic (if permitted). On +t channels, only operators
@@ -41,63 +41,44 @@
  * - TOPIC #general :Welcome to the general discussion channel!
  */
 
-void Server::topicCommand(int client_fd, const std::string &params)
+void Server::topicCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client || !client->isAuthenticated())
-    {
-        if (client)
-            client->sendMessage(":irc.local 451 * :You have not registered\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string channel_name;
-    iss >> channel_name;   
-    if (channel_name.empty())
-    {
-        client->sendMessage(ERR_NEEDMOREPARAMS(client->getNick(), "TOPIC") + "\r\n");
-        return;
-    }
-    
+    std::string channel_name = msg.param(0).str();
     std::map<std::string, Channel*>::iterator chan_it = _channels.find(channel_name);
     if (chan_it == _channels.end())
     {
-        client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNoSuchChannel(client, channel_name);
         return;
     }
     
     Channel* channel = chan_it->second;
     if (!channel->isMember(client))
     {
-        client->sendMessage(ERR_NOTONCHANNEL(client->getNick(), channel_name) + "\r\n");
+        errNotOnChannel(client, channel_name);
         return;
     }
-    size_t topic_pos = params.find(" :");
-    if (topic_pos == std::string::npos)
+    if (msg.paramCount < 2)
     {
         if (channel->getTopic().empty())
         {
-            client->sendMessage(RPL_NOTOPIC(client->getNick(), channel_name) + "\r\n");
+            rplNoTopic(client, channel_name);
         }
         else
         {
-            client->sendMessage(RPL_TOPIC(client->getNick(), channel_name, channel->getTopic()) + "\r\n");
+            rplTopic(client, channel_name, channel->getTopic());
         }
         return;
     }
-    std::string new_topic = params.substr(topic_pos + 2);
+    std::string new_topic = msg.params[1].str();
     if (!channel->canSetTopic(client))
     {
-        client->sendMessage(ERR_CHANOPRIVSNEEDED(client->getNick(), channel_name) + "\r\n");
+        errChanOPrivsNeeded(client, channel_name);
         return;
     }
     channel->setTopic(new_topic, client);
-    std::string topic_msg = ":" + client->getNick() + "!" + client->getUser() 
-                          + "@localhost TOPIC " + channel_name + " :" + new_topic + "\r\n";
-    channel->broadcastMessage(topic_msg);
+    channel->broadcastMessage(client->relayMessage("TOPIC", channel_name, new_topic));
     
-    std::cout << client->getNick() << " changed topic of " << channel_name 
-              << " to: " << new_topic << std::endl;
+    LOG_INFO(LOG_CHANNEL) << client->getNick() << " changed topic of " << channel_name 
+              << " to: " << new_topic;
     
 }
\ No newline at end of file
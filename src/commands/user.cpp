@@ -17,8 +17,8 @@
 /**
  * @brief USER - User registration command
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Username, mode, unused, and realname parameters
+ * @param client Client sending the command
+ * @param msg Parsed message: username, mode, unused, and realname parameters
  * 
  * @details The USER command is used at the beginning of a connection to specify the
  *          username, hostname, servername, and realname of a new user. This command
@@ -60,42 +60,25 @@
  * - 004 RPL_MYINFO: Server name, version, and available modes
  */
 
-void Server::userCommand(int client_fd, const std::string &params)
+void Server::userCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client) return;
-    
-    std::istringstream iss(params);
-    std::string username;
-    iss >> username;
-    
-    client->setUser(username);
+    client->setUser(msg.param(0).str());
     
     // Check if we can authenticate the client
     if (!client->getNick().empty() && !client->getUser().empty() && !client->isAuthenticated())
     {
         if (client->getPass() != _pass)
         {
-            sendError(client_fd, ":irc.local 464 * :Password incorrect");
+            errPasswdMismatch(client);
             return;
         }
         
         client->authenticate();
-        std::cout << "Client authenticated: " << client->getNick() << std::endl;
+        LOG_INFO(LOG_CLIENT) << "Client authenticated: " << client->getNick();
         //client->sendMessage(":irc.local 001 " + client->getNick() + " :Welcome to the IRC server!\r\n");
-		std::string prefix   = ":ft_irc ";
-		std::string nick     = client->getNick();
-		std::string user     = client->getUser();
-		std::string host     = client->getHost();
-		std::string version  = "ft_IRC-1.0";
-		std::string creation = "Mon Jul 12 2025 at 11:00:00";
-
-		client->sendMessage(prefix + "001 " + nick + " :Welcome to the Internet Relay Network " 
-							+ nick + "!" + user + "@" + host + "\r\n");
-		client->sendMessage(prefix + "002 " + nick + " :Your host is ft_irc, running version " + version + "\r\n");
-		client->sendMessage(prefix + "003 " + nick + " :This server was created " 
-							+ creation + "\r\n");
-		client->sendMessage(prefix + "004 " + nick + " ft_irc " 
-							+ version + " o itkol\r\n");
+		rplWelcome(client);
+		rplYourHost(client);
+		rplCreated(client);
+		rplMyInfo(client);
 	}
 }
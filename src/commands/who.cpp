@@ -17,8 +17,8 @@
 /**
  * @brief WHO - Query information about users
  * 
- * @param client_fd File descriptor of the client sending the command
- * @param params Optional mask (channel name, nickname, or empty)
+ * @param client Client sending the command
+ * @param msg Parsed message: optional mask (channel name, nickname, or empty)
  * 
  * @details The WHO command is used to query a list of users who match the provided
  *          mask. The mask can be a channel name to list all users in that channel,
@@ -47,7 +47,7 @@
  *   Format: <channel> <user> <host> <server> <nick> <flags> :<hopcount> <realname>
  *   - channel: Channel where user was found (* if no shared channel)
  *   - user: Username
- *   - host: Hostname (typically "localhost")
+ *   - host: Client's host (its IP address)
  *   - server: Server name (typically "irc.local")
  *   - nick: Nickname
  *   - flags: Status flags (H = Here, @ = Operator)
@@ -72,74 +72,43 @@
  *   Lists all users in your channels
  */ 
 
-void Server::whoCommand(int client_fd, const std::string &params)
+void Server::whoCommand(Client* client, const IrcMessage &msg)
 {
-    Client* client = getClientByFd(client_fd);
-    if (!client) return;
-    
-    if (!client->isAuthenticated())
-    {
-        client->sendMessage(ERR_NOTREGISTERED(client->getNick()) + "\r\n");
-        return;
-    }
-    
-    std::istringstream iss(params);
-    std::string target;
-    iss >> target;
+    std::string target = msg.param(0).str();
     
     if (target.empty())
     {
         std::set<Client*> visible_clients;
-        std::vector<std::string> my_channels = client->getChannels();
-        for (std::vector<std::string>::const_iterator it = my_channels.begin();
+        const std::vector<Channel*>& my_channels = client->getChannels();
+        for (std::vector<Channel*>::const_iterator it = my_channels.begin();
              it != my_channels.end(); ++it)
         {
-            std::map<std::string, Channel*>::iterator chan_it = _channels.find(*it);
-            if (chan_it != _channels.end() && chan_it->second != NULL)
+            const Channel::MemberList& members = (*it)->getMembers();
+            for (Channel::MemberList::const_iterator member_it = members.begin();
+                 member_it != members.end(); ++member_it)
             {
-                std::vector<Client*> members = chan_it->second->getMembers();
-                for (std::vector<Client*>::const_iterator member_it = members.begin();
-                     member_it != members.end(); ++member_it)
-                {
-                    visible_clients.insert(*member_it);
-                }
+                visible_clients.insert(*member_it);
             }
         }
         for (std::set<Client*>::iterator it = visible_clients.begin();
              it != visible_clients.end(); ++it)
         {
             Client* target_client = *it;
-            std::string flags = "H"; // H = Here (not away)
-            
             bool is_op = false;
-            for (std::vector<std::string>::const_iterator chan_it = my_channels.begin();
+            for (std::vector<Channel*>::const_iterator chan_it = my_channels.begin();
                  chan_it != my_channels.end(); ++chan_it)
             {
-                std::map<std::string, Channel*>::iterator channel_it = _channels.find(*chan_it);
-                if (channel_it != _channels.end() && channel_it->second != NULL &&
-                    channel_it->second->isMember(target_client) &&
-                    channel_it->second->isOperator(target_client))
+                if ((*chan_it)->isOperator(target_client))
                 {
                     is_op = true;
                     break;
                 }
             }
             
-            if (is_op)
-                flags = "@" + flags;
-            std::string who_reply = RPL_WHOREPLY(
-                client->getNick(),
-                "*",
-                target_client->getUser(),
-                "localhost",
-                "irc.local",
-                target_client->getNick(),
-                flags,
-                target_client->getUser()
-            );
-            client->sendMessage(who_reply + "\r\n");
+            const char* flags = is_op ? "@H" : "H"; // H = Here (not away)
+            rplWhoReply(client, "*", target_client, flags);
         }
-        client->sendMessage(RPL_ENDOFWHO(client->getNick(), "*") + "\r\n");
+        rplEndOfWho(client, "*");
         return;
     }
     if (target[0] == '#' || target[0] == '&')
@@ -147,86 +116,45 @@ void Server::whoCommand(int client_fd, const std::string &params)
         std::map<std::string, Channel*>::iterator chan_it = _channels.find(target);
         if (chan_it == _channels.end())
         {
-            client->sendMessage(ERR_NOSUCHCHANNEL(client->getNick(), target) + "\r\n");
+            errNoSuchChannel(client, target);
             return;
         }   
         Channel* channel = chan_it->second;
-        std::vector<Client*> members = channel->getMembers();
-        for (std::vector<Client*>::const_iterator it = members.begin();
+        const Channel::MemberList& members = channel->getMembers();
+        for (Channel::MemberList::const_iterator it = members.begin();
              it != members.end(); ++it)
         {
             Client* member = *it;
-            std::string flags = "H"; // H = Here (not away)
-            if (channel->isOperator(member))
-                flags = "@" + flags;
-            std::string who_reply = RPL_WHOREPLY(
-                client->getNick(),
-                target,
-                member->getUser(),
-                "localhost",
-                "irc.local",
-                member->getNick(),
-                flags,
-                member->getUser()
-            );
-            client->sendMessage(who_reply + "\r\n");
+            const char* flags = channel->isOperator(member) ? "@H" : "H"; // H = Here (not away)
+            rplWhoReply(client, target, member, flags);
         }        
-        client->sendMessage(RPL_ENDOFWHO(client->getNick(), target) + "\r\n");
+        rplEndOfWho(client, target);
     }
     else
     {
-        Client* target_client = NULL;
-        for (std::vector<Client*>::iterator it = _clients.begin();
-             it != _clients.end(); ++it)
-        {
-            if ((*it)->getNick() == target)
-            {
-                target_client = *it;
-                break;
-            }
-        }        
+        Client* target_client = getClientByNick(target);
         if (!target_client)
         {
-            client->sendMessage(ERR_NOSUCHNICK(client->getNick(), target) + "\r\n");
+            errNoSuchNick(client, target);
             return;
         }
         std::string show_channel = "*";
-        std::string flags = "H";
+        const char* flags = "H";
         
-        std::vector<std::string> my_channels = client->getChannels();
-        std::vector<std::string> target_channels = target_client->getChannels();
-        
-        for (std::vector<std::string>::const_iterator my_it = my_channels.begin();
+        // first channel shared with the target, checked from our side in O(1) each
+        const std::vector<Channel*>& my_channels = client->getChannels();
+        for (std::vector<Channel*>::const_iterator my_it = my_channels.begin();
              my_it != my_channels.end(); ++my_it)
         {
-            for (std::vector<std::string>::const_iterator target_it = target_channels.begin();
-                 target_it != target_channels.end(); ++target_it)
+            if ((*my_it)->isMember(target_client))
             {
-                if (*my_it == *target_it)
-                {
-                    show_channel = *my_it;
-                    std::map<std::string, Channel*>::iterator chan_it = _channels.find(*my_it);
-                    if (chan_it != _channels.end() && chan_it->second->isOperator(target_client))
-                    {
-                        flags = "@" + flags;
-                    }
-                    break;
-                }
-            }
-            if (show_channel != "*")
+                show_channel = (*my_it)->getName();
+                if ((*my_it)->isOperator(target_client))
+                    flags = "@H";
                 break;
+            }
         }
-        std::string who_reply = RPL_WHOREPLY(
-            client->getNick(),
-            show_channel,
-            target_client->getUser(),
-            "localhost",
-            "irc.local",
-            target_client->getNick(),
-            flags,
-            target_client->getUser()
-        );
-        client->sendMessage(who_reply + "\r\n");
-        client->sendMessage(RPL_ENDOFWHO(client->getNick(), target) + "\r\n");
+        rplWhoReply(client, show_channel, target_client, flags);
+        rplEndOfWho(client, target);
     }
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "fanout.hpp"
+#include "server.hpp"
+#include "client.hpp"
+
+unsigned int FanoutPool::_workers = 0;
+pthread_t FanoutPool::_threads[FANOUT_MAX_WORKERS];
+std::vector<int> FanoutPool::_flushes[FANOUT_MAX_WORKERS];
+FanoutPool::Job FanoutPool::_job;
+unsigned long FanoutPool::_generation = 0;
+unsigned int FanoutPool::_pending = 0;
+bool FanoutPool::_stopping = false;
+pthread_mutex_t FanoutPool::_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t FanoutPool::_wakeup = PTHREAD_COND_INITIALIZER;
+pthread_cond_t FanoutPool::_done = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Starts the workers (none = every broadcast stays on its reactor)
+ *
+ * @param workers Threads to start, capped at FANOUT_MAX_WORKERS
+ */
+void FanoutPool::start(unsigned int workers)
+{
+	workers = std::min(workers, static_cast<unsigned int>(FANOUT_MAX_WORKERS));
+	// SIGINT has to reach the main thread, not a worker
+	sigset_t block;
+	sigset_t old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		if (pthread_create(&_threads[i], NULL, worker, reinterpret_cast<void *>(static_cast<size_t>(i))) != 0)
+			break;
+		_workers++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (_workers > 0)
+		LOG_INFO(LOG_SERVER) << "Fan-out pool: " << _workers << " workers for channels of "
+			<< FANOUT_MIN_MEMBERS << "+ members";
+}
+
+void FanoutPool::stop()
+{
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_broadcast(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+	for (unsigned int i = 0; i < _workers; i++)
+		pthread_join(_threads[i], NULL);
+	_workers = 0;
+}
+
+/**
+ * @brief Broadcast to members (except skip), split across the workers
+ *
+ * @param relayed true for chat, which a throttled client does not get
+ */
+void FanoutPool::run(const std::vector<Client*> &members, Client *skip,
+	const SharedMessage &message, bool relayed)
+{
+	// the workers queue our clients' output directly, so whatever other
+	// reactors posted to them goes first (nothing new arrives: we hold the
+	// ServerState lock)
+	Server::current()->catchUpInbox();
+	pthread_mutex_lock(&_mutex);
+	_job.members = &members;
+	_job.skip = skip;
+	_job.message = message;
+	_job.relayed = relayed;
+	_job.reactor = Server::current();
+	_generation++;
+	_pending = _workers;
+	pthread_cond_broadcast(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+
+	// the calling reactor takes the last slice itself
+	deliver(_job, _workers);
+
+	pthread_mutex_lock(&_mutex);
+	while (_pending > 0)
+		pthread_cond_wait(&_done, &_mutex);
+	_job.message.reset();
+	pthread_mutex_unlock(&_mutex);
+	for (unsigned int i = 0; i < _workers; i++)
+	{
+		_job.reactor->scheduleFlushes(_flushes[i]);
+		_flushes[i].clear();
+	}
+}
+
+void *FanoutPool::worker(void *arg)
+{
+	size_t slice = reinterpret_cast<size_t>(arg);
+	unsigned long seen = 0;
+	pthread_mutex_lock(&_mutex);
+	while (true)
+	{
+		while (_generation == seen && !_stopping)
+			pthread_cond_wait(&_wakeup, &_mutex);
+		if (_stopping)
+			break;
+		seen = _generation;
+		pthread_mutex_unlock(&_mutex);
+
+		// flushes are collected here and handed to the reactor afterwards
+		Server::enterFanout(_job.reactor, &_flushes[slice]);
+		deliver(_job, slice);
+		Server::enterFanout(NULL, NULL);
+
+		pthread_mutex_lock(&_mutex);
+		if (--_pending == 0)
+			pthread_cond_signal(&_done);
+	}
+	pthread_mutex_unlock(&_mutex);
+	return NULL;
+}
+
+void FanoutPool::deliver(const Job &job, size_t slice)
+{
+	const std::vector<Client*> &members = *job.members;
+	size_t slices = _workers + 1;
+	size_t end = members.size() * (slice + 1) / slices;
+	for (size_t i = members.size() * slice / slices; i < end; i++)
+	{
+		Client *member = members[i];
+		if (member == job.skip)
+			continue;
+		if (job.relayed)
+			member->sendRelayed(job.message);
+		else
+			member->sendMessage(job.message);
+	}
+}
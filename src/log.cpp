@@ -0,0 +1,303 @@
+#include "log.hpp"
+#include "message.hpp"
+
+#ifdef IRC_DEBUG_LOG
+LogLevel Log::_level = LEVEL_DEBUG;
+#else
+LogLevel Log::_level = LEVEL_INFO;
+#endif
+unsigned int Log::_categories = LOG_ALL;
+char Log::_ring[LOG_RING_SIZE] __attribute__((aligned(8)));
+size_t Log::_head = 0;
+size_t Log::_tail = 0;
+size_t Log::_sent = 0;
+size_t Log::_dropped = 0;
+int Log::_flushing = 0;
+int Log::_stdoutFlags = -1;
+__thread time_t Log::_stampTime = 0;
+__thread char Log::_stamp[16] = "00:00:00";
+
+/**
+ * @brief Applies the runtime switches (IRCSERV_LOG_LEVEL and IRCSERV_LOG)
+ *
+ * @param level "debug", "info", "warn" or "error" (NULL keeps the default)
+ * @param categories Comma-separated list of "server", "client", "command",
+ *        "channel", or "all" (NULL keeps all of them)
+ */
+void Log::configure(const char *level, const char *categories)
+{
+	if (level)
+	{
+		StringView name(level);
+		if (name.iequals("debug"))
+			_level = LEVEL_DEBUG;
+		else if (name.iequals("info"))
+			_level = LEVEL_INFO;
+		else if (name.iequals("warn"))
+			_level = LEVEL_WARN;
+		else if (name.iequals("error"))
+			_level = LEVEL_ERROR;
+	}
+	if (categories)
+	{
+		StringView list(categories);
+		StringView item;
+		size_t pos = 0;
+		_categories = 0;
+		while (nextListItem(list, pos, item))
+		{
+			if (item.iequals("server"))
+				_categories |= LOG_SERVER;
+			else if (item.iequals("client"))
+				_categories |= LOG_CLIENT;
+			else if (item.iequals("command"))
+				_categories |= LOG_COMMAND;
+			else if (item.iequals("channel"))
+				_categories |= LOG_CHANNEL;
+			else if (item.iequals("all"))
+				_categories |= LOG_ALL;
+		}
+	}
+	tick();
+}
+
+// Refreshes the cached timestamp; called once per loop iteration
+void Log::tick()
+{
+	time_t now = time(NULL);
+	if (now == _stampTime)
+		return;
+	_stampTime = now;
+	struct tm local;
+	strftime(_stamp, sizeof(_stamp), "%H:%M:%S", localtime_r(&now, &local));
+}
+
+// Lock-free: the record is claimed by moving _head with a CAS (it only
+// grows, so there is no ABA), filled, and then marked ready
+void Log::push(const char *line, size_t len)
+{
+	size_t size = recordSize(len);
+	size_t head = __sync_fetch_and_add(&_head, 0);
+	while (true)
+	{
+		if (LOG_RING_SIZE - (head - __sync_fetch_and_add(&_tail, 0)) < size)
+		{
+			__sync_fetch_and_add(&_dropped, 1);
+			return;
+		}
+		size_t seen = __sync_val_compare_and_swap(&_head, head, head + size);
+		if (seen == head)
+			break;
+		head = seen;
+	}
+	Record *record = recordAt(head);
+	record->len = len;
+	size_t at = (head + sizeof(Record)) % LOG_RING_SIZE;
+	size_t first = std::min(len, LOG_RING_SIZE - at);
+	memcpy(_ring + at, line, first);
+	memcpy(_ring, line + first, len - first);
+	__sync_val_compare_and_swap(&record->ready, 0, 1);
+}
+
+/**
+ * @brief Puts stdout in non-blocking mode, so that a slow terminal or a full
+ *        pipe cannot stall the event loop in flush()
+ *
+ * The flag belongs to the open file, which the shell and a terminal's stderr
+ * may share: close() puts the original flags back.
+ */
+void Log::open()
+{
+	int flags = fcntl(STDOUT_FILENO, F_GETFL);
+	if (flags == -1 || fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) == -1)
+		return;
+	_stdoutFlags = flags;
+}
+
+/**
+ * @brief Restores stdout's flags and writes out what is still in the ring,
+ *        blocking if it has to
+ */
+void Log::close()
+{
+	if (_stdoutFlags != -1)
+		fcntl(STDOUT_FILENO, F_SETFL, _stdoutFlags);
+	_stdoutFlags = -1;
+	flush();
+}
+
+// Writes out the lines that are ready (LOG_FLUSH_IOV per writev(); the text
+// of a line may wrap, so it can take two entries). Once Log::open() made
+// stdout non-blocking, a stdout that is full (EAGAIN) stops the flush and
+// the lines left, part of one included, wait in the ring for the next one;
+// new lines are dropped (and counted) if the ring fills up meanwhile. Only
+// one thread flushes at a time; the others return at once and their lines
+// go out with the next flush.
+void Log::flush()
+{
+	if (!__sync_bool_compare_and_swap(&_flushing, 0, 1))
+		return;
+	bool blocked = false;
+	while (true)
+	{
+		struct iovec iov[LOG_FLUSH_IOV];
+		int count = 0;
+		size_t head = __sync_fetch_and_add(&_head, 0);
+		size_t pos = __sync_fetch_and_add(&_tail, 0);
+		size_t skip = _sent;
+		while (pos != head && count + 2 <= LOG_FLUSH_IOV)
+		{
+			Record *record = recordAt(pos);
+			if (!__sync_fetch_and_add(&record->ready, 0))
+				break;
+			size_t at = (pos + sizeof(Record) + skip) % LOG_RING_SIZE;
+			size_t left = record->len - skip;
+			size_t first = std::min(left, LOG_RING_SIZE - at);
+			iov[count].iov_base = _ring + at;
+			iov[count++].iov_len = first;
+			if (left > first)
+			{
+				iov[count].iov_base = _ring;
+				iov[count++].iov_len = left - first;
+			}
+			pos += recordSize(record->len);
+			skip = 0;
+		}
+		if (count == 0)
+			break;
+		ssize_t written = writev(STDOUT_FILENO, iov, count);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0) // EAGAIN included: stdout is full for now
+		{
+			blocked = true;
+			break;
+		}
+		release(written);
+	}
+	__sync_lock_release(&_flushing);
+	// the drops are reported once stdout took everything: before that the
+	// warning would only be dropped as well
+	if (blocked)
+		return;
+	size_t dropped = __sync_lock_test_and_set(&_dropped, 0);
+	if (dropped > 0)
+	{
+		LOG_WARN(LOG_SERVER) << dropped << " log lines dropped (ring full)";
+		flush();
+	}
+}
+
+// Hands the records written out back to the writers. Their space is zeroed
+// before _tail moves past it: records are laid out differently on the next
+// pass, and a header landing on old text must not look ready.
+void Log::release(size_t written)
+{
+	size_t tail = __sync_fetch_and_add(&_tail, 0);
+	while (written > 0)
+	{
+		Record *record = recordAt(tail);
+		size_t left = record->len - _sent;
+		if (written < left)
+		{
+			_sent += written;
+			return;
+		}
+		written -= left;
+		_sent = 0;
+		size_t size = recordSize(record->len);
+		size_t at = tail % LOG_RING_SIZE;
+		size_t first = std::min(size, LOG_RING_SIZE - at);
+		memset(_ring + at, 0, first);
+		memset(_ring, 0, size - first);
+		tail = __sync_add_and_fetch(&_tail, size);
+	}
+}
+
+LogLine::LogLine(LogLevel level, LogCategory category) : _len(0)
+{
+	static const char *const levels[] = { "DEBUG ", "INFO  ", "WARN  ", "ERROR " };
+	const char *name = "server";
+	if (category == LOG_CLIENT)
+		name = "client";
+	else if (category == LOG_COMMAND)
+		name = "command";
+	else if (category == LOG_CHANNEL)
+		name = "channel";
+	*this << Log::stamp() << ' ' << levels[level] << '[' << name << "] ";
+}
+
+LogLine::~LogLine()
+{
+	if (_len == LOG_LINE_MAX - 1)
+		memcpy(_buf + _len - 3, "...", 3);
+	_buf[_len++] = '\n';
+	Log::push(_buf, _len);
+}
+
+// keeps one byte free for the newline
+void LogLine::append(const char *data, size_t len)
+{
+	size_t room = LOG_LINE_MAX - 1 - _len;
+	if (len > room)
+		len = room;
+	memcpy(_buf + _len, data, len);
+	_len += len;
+}
+
+LogLine &LogLine::operator<<(const char *str)
+{
+	append(str, strlen(str));
+	return *this;
+}
+
+LogLine &LogLine::operator<<(const std::string &str)
+{
+	append(str.data(), str.size());
+	return *this;
+}
+
+LogLine &LogLine::operator<<(const StringView &str)
+{
+	append(str.data(), str.size());
+	return *this;
+}
+
+LogLine &LogLine::operator<<(char c)
+{
+	append(&c, 1);
+	return *this;
+}
+
+LogLine &LogLine::operator<<(int n)
+{
+	return *this << static_cast<long>(n);
+}
+
+LogLine &LogLine::operator<<(unsigned int n)
+{
+	return *this << static_cast<unsigned long>(n);
+}
+
+LogLine &LogLine::operator<<(long n)
+{
+	if (n < 0)
+	{
+		*this << '-';
+		return *this << static_cast<unsigned long>(-(n + 1)) + 1;
+	}
+	return *this << static_cast<unsigned long>(n);
+}
+
+LogLine &LogLine::operator<<(unsigned long n)
+{
+	char digits[20];
+	size_t i = sizeof(digits);
+	do
+	{
+		digits[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	append(digits + i, sizeof(digits) - i);
+	return *this;
+}
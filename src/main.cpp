@@ -11,6 +11,7 @@
 /* ************************************************************************** */
 
 #include "server.hpp"
+#include "fanout.hpp"
 #include "utils/utils.hpp"
 #include <csignal>
 
@@ -21,28 +22,138 @@ void handle_sigint(int)
     g_running = 0;
 }
 
+struct Reactor
+{
+    Server      *server;
+    ServerState *state;
+};
+
+// Event loop of one reactor; when one stops (SIGINT or a fatal error), all
+// the others are stopped too
+static void *runReactor(void *arg)
+{
+    Reactor *reactor = static_cast<Reactor *>(arg);
+    try
+    {
+        reactor->server->run();
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(LOG_SERVER) << "Reactor stopped: " << e.what();
+    }
+    reactor->state->stopAll();
+    return NULL;
+}
+
+// One reactor per thread, each with its own listener (SO_REUSEPORT), epoll
+// instance and clients. The first one runs on the main thread, which is
+// the only thread SIGINT is delivered to.
+static void runReactors(int port, const std::string &pass, int count)
+{
+    ServerState state(true);
+    std::vector<Server *> servers;
+    try
+    {
+        for (int i = 0; i < count; i++)
+        {
+            servers.push_back(new Server(port, pass, state));
+            servers.back()->setup();
+        }
+    }
+    catch (const std::exception &)
+    {
+        for (size_t i = 0; i < servers.size(); i++)
+            delete servers[i];
+        throw;
+    }
+    LOG_INFO(LOG_SERVER) << "Running " << count << " reactor threads";
+
+    std::vector<Reactor> reactors(count);
+    std::vector<pthread_t> threads;
+    sigset_t block;
+    sigset_t old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old); // inherited by the new threads
+    bool failed = false;
+    for (int i = 0; i < count; i++)
+    {
+        reactors[i].server = servers[i];
+        reactors[i].state = &state;
+        if (i == 0)
+            continue;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, runReactor, &reactors[i]) != 0)
+        {
+            failed = true;
+            break;
+        }
+        threads.push_back(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (failed)
+        state.stopAll();
+    else
+        runReactor(&reactors[0]);
+    for (size_t i = 0; i < threads.size(); i++)
+        pthread_join(threads[i], NULL);
+    // clients first, the channels go with the state
+    for (size_t i = 0; i < servers.size(); i++)
+        delete servers[i];
+    if (failed)
+        throw std::runtime_error("Failed to start reactor threads");
+}
+
 int main(int ac, char **av)
 {    
-    if (ac != 3)
+    if (ac != 3 && ac != 4)
+    {
+        std::cout << "./ircserver <port> <serverpassword> [threads]" << std::endl;
+        return(1);
+    }
+    int threads = (ac == 4) ? std::atoi(av[3]) : 1;
+    if (threads < 1 || threads > MAX_REACTORS)
     {
-        std::cout << "./ircserver <port> <serverpassword>" << std::endl;
+        std::cout << "threads must be between 1 and " << MAX_REACTORS << std::endl;
         return(1);
     }
     try
 	{
         // Initialize the server with a port and optional password
         //int port = 6667; // Default IRC port
-        Server server(std::atoi(av[1]), av[2]);
-		
-		std::signal(SIGINT, handle_sigint);
-        // Start the server (includes the main event loop)
-        server.start();
+        Log::configure(std::getenv("IRCSERV_LOG_LEVEL"), std::getenv("IRCSERV_LOG"));
+        Log::open();
+        // binary event trace for post-mortems; IRCSERV_TRACE= turns it off
+        const char *trace = std::getenv("IRCSERV_TRACE");
+        Trace::open(trace ? trace : "ircserv.trace");
+        std::signal(SIGINT, handle_sigint);
+        // optional helper threads for broadcasts into very large channels;
+        // none unless asked for, see include/fanout.hpp
+        const char *fanout = std::getenv("IRCSERV_FANOUT_WORKERS");
+        int workers = fanout ? std::atoi(fanout) : 0;
+        FanoutPool::start(workers > 0 ? workers : 0);
+        if (threads > 1)
+            runReactors(std::atoi(av[1]), av[2], threads);
+        else
+        {
+            ServerState state(false);
+            Server server(std::atoi(av[1]), av[2], state);
+            // Start the server (includes the main event loop)
+            server.start();
+        }
     } 
 	catch (const std::exception &e)
 	{
+        FanoutPool::stop();
+        Log::close();
+        Trace::close();
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
+    FanoutPool::stop();
+    Log::close();
+    Trace::close();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,104 @@
+#include "message.hpp"
+
+IrcMessage::IrcMessage() : paramCount(0), hasTrailing(false)
+{
+}
+
+const StringView &IrcMessage::param(size_t index) const
+{
+	static const StringView missing;
+	return index < paramCount ? params[index] : missing;
+}
+
+// returns the token starting at i (up to the next space) and moves i past it
+static StringView nextToken(const StringView &line, size_t &i)
+{
+	size_t end = line.find(' ', i);
+	if (end == StringView::npos)
+		end = line.size();
+	StringView token = line.substr(i, end - i);
+	i = end;
+	return token;
+}
+
+static void skipSpaces(const StringView &line, size_t &i)
+{
+	while (i < line.size() && line[i] == ' ')
+		i++;
+}
+
+/**
+ * @brief Splits a line into tags, prefix, command and parameters in one pass
+ *
+ * @details Nothing is copied or allocated: every field of msg ends up as a view
+ *          into line. The trailing parameter (after " :") keeps its spaces, and a
+ *          15th parameter swallows the rest of the line even without a colon.
+ *
+ * @return false if the line holds no command
+ */
+bool parseMessage(const StringView &line, IrcMessage &msg)
+{
+	msg = IrcMessage();
+	size_t i = 0;
+
+	skipSpaces(line, i);
+	if (i < line.size() && line[i] == '@')
+	{
+		i++;
+		msg.tags = nextToken(line, i);
+		skipSpaces(line, i);
+	}
+	if (i < line.size() && line[i] == ':')
+	{
+		i++;
+		msg.prefix = nextToken(line, i);
+		skipSpaces(line, i);
+	}
+	msg.command = nextToken(line, i);
+	if (msg.command.empty())
+		return false;
+
+	skipSpaces(line, i);
+	msg.rawParams = line.substr(i);
+	while (i < line.size())
+	{
+		if (line[i] == ':' || msg.paramCount == IRC_MAX_PARAMS - 1)
+		{
+			if (line[i] == ':')
+				i++;
+			msg.params[msg.paramCount++] = line.substr(i);
+			msg.hasTrailing = true;
+			break;
+		}
+		msg.params[msg.paramCount++] = nextToken(line, i);
+		skipSpaces(line, i);
+	}
+	return true;
+}
+
+/**
+ * @brief Walks a comma-separated parameter ("#a,#b", "key1,,key3")
+ *
+ * @details Start with pos = 0; each call stores the next item (possibly empty)
+ *          in item and returns false once the list is exhausted.
+ */
+bool nextListItem(const StringView &list, size_t &pos, StringView &item)
+{
+	if (pos > list.size() || list.empty())
+		return false;
+	size_t end = list.find(',', pos);
+	if (end == StringView::npos)
+		end = list.size();
+	item = list.substr(pos, end - pos);
+	pos = end + 1;
+	return true;
+}
+
+// Length limit for a line starting like this one (tagged lines get room for
+// their tags on top of the usual 510 bytes)
+size_t maxLineLength(const StringView &line)
+{
+	if (!line.empty() && line[0] == '@')
+		return IRC_MAX_TAGS + IRC_MAX_LINE;
+	return IRC_MAX_LINE;
+}
@@ -0,0 +1,250 @@
+#include "replies.hpp"
+#include "client.hpp"
+
+namespace
+{
+	// enough for the widest numeric (RPL_WHOREPLY)
+	const size_t MAX_REPLY_PARTS = 32;
+
+	// Collects the pieces of one numeric as views and hands them to the
+	// client in one go: ":irc.local <code> <target> <params...> [:<trailing>]"
+	class ReplyBuilder
+	{
+		public:
+			ReplyBuilder(Client *to, const char *code) : _to(to), _count(0)
+			{
+				const std::string &nick = to->getNick();
+				raw(":" SERVER_NAME " ");
+				raw(code);
+				param(nick.empty() ? StringView("*") : StringView(nick));
+			}
+
+			ReplyBuilder &raw(const StringView &part)
+			{
+				_parts[_count++] = part;
+				return *this;
+			}
+
+			ReplyBuilder &param(const StringView &value)
+			{
+				return raw(" ").raw(value);
+			}
+
+			ReplyBuilder &trailing(const StringView &value)
+			{
+				return raw(" :").raw(value);
+			}
+
+			void send()
+			{
+				raw("\r\n");
+				_to->sendParts(_parts, _count);
+			}
+
+		private:
+			Client		*_to;
+			StringView	_parts[MAX_REPLY_PARTS];
+			size_t		_count;
+	};
+
+	const char *const SERVER_CREATED = "Mon Jul 12 2025 at 11:00:00";
+}
+
+void rplWelcome(Client *to)
+{
+	const std::string &prefix = to->getPrefix();
+	ReplyBuilder(to, "001").trailing("Welcome to the Internet Relay Network ")
+		.raw(StringView(prefix).substr(1)).send();
+}
+
+void rplYourHost(Client *to)
+{
+	ReplyBuilder(to, "002").trailing("Your host is " SERVER_NAME ", running version " SERVER_VERSION).send();
+}
+
+void rplCreated(Client *to)
+{
+	ReplyBuilder(to, "003").trailing("This server was created ").raw(SERVER_CREATED).send();
+}
+
+void rplMyInfo(Client *to)
+{
+	ReplyBuilder(to, "004").param(SERVER_NAME).param(SERVER_VERSION).param("o").param("itkol").send();
+}
+
+void rplAway(Client *to, const StringView &nick, const StringView &message)
+{
+	ReplyBuilder(to, "301").param(nick).trailing(message).send();
+}
+
+void rplEndOfWho(Client *to, const StringView &name)
+{
+	ReplyBuilder(to, "315").param(name).trailing("End of WHO list").send();
+}
+
+void rplChannelModeIs(Client *to, const StringView &channel, const StringView &modes)
+{
+	// modes already carries its arguments ("+kl key 10")
+	ReplyBuilder(to, "324").param(channel).param(modes).send();
+}
+
+void rplNoTopic(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "331").param(channel).trailing("No topic is set").send();
+}
+
+void rplTopic(Client *to, const StringView &channel, const StringView &topic)
+{
+	ReplyBuilder(to, "332").param(channel).trailing(topic).send();
+}
+
+void rplTopicWhoTime(Client *to, const StringView &channel, const StringView &nick,
+	const StringView &time)
+{
+	ReplyBuilder(to, "333").param(channel).param(nick).param(time).send();
+}
+
+void rplInviting(Client *to, const StringView &nick, const StringView &channel)
+{
+	ReplyBuilder(to, "341").param(nick).param(channel).send();
+}
+
+// the username doubles as the real name, and every client is 0 hops away
+void rplWhoReply(Client *to, const StringView &channel, const Client *who,
+	const StringView &flags)
+{
+	ReplyBuilder(to, "352").param(channel).param(who->getUser()).param(who->getHost())
+		.param(SERVER_NAME).param(who->getNick()).param(flags)
+		.trailing("0 ").raw(who->getUser()).send();
+}
+
+void rplNamReply(Client *to, const StringView &channel, const StringView &names)
+{
+	ReplyBuilder(to, "353").param("=").param(channel).trailing(names).send();
+}
+
+void rplEndOfNames(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "366").param(channel).trailing("End of /NAMES list").send();
+}
+
+void errNoSuchNick(Client *to, const StringView &nick)
+{
+	ReplyBuilder(to, "401").param(nick).trailing("No such nick/channel").send();
+}
+
+void errNoSuchChannel(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "403").param(channel).trailing("No such channel").send();
+}
+
+void errCannotSendToChan(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "404").param(channel).trailing("Cannot send to channel").send();
+}
+
+void errTooManyChannels(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "405").param(channel).trailing("You have joined too many channels").send();
+}
+
+void errNoRecipient(Client *to, const StringView &command)
+{
+	ReplyBuilder(to, "411").trailing("No recipient given (").raw(command).raw(")").send();
+}
+
+void errNoTextToSend(Client *to)
+{
+	ReplyBuilder(to, "412").trailing("No text to send").send();
+}
+
+void errInputTooLong(Client *to)
+{
+	ReplyBuilder(to, "417").trailing("Input line was too long").send();
+}
+
+void errUnknownCommand(Client *to, const StringView &command)
+{
+	ReplyBuilder(to, "421").param(command).trailing("Unknown command").send();
+}
+
+void errNoNicknameGiven(Client *to)
+{
+	ReplyBuilder(to, "431").trailing("No nickname given").send();
+}
+
+void errErroneusNickname(Client *to, const StringView &nick)
+{
+	ReplyBuilder(to, "432").param(nick).trailing("Erroneous nickname").send();
+}
+
+void errNicknameInUse(Client *to, const StringView &nick)
+{
+	ReplyBuilder(to, "433").param(nick).trailing("Nickname is already in use").send();
+}
+
+void errUserNotInChannel(Client *to, const StringView &nick, const StringView &channel)
+{
+	ReplyBuilder(to, "441").param(nick).param(channel).trailing("They aren't on that channel").send();
+}
+
+void errNotOnChannel(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "442").param(channel).trailing("You're not on that channel").send();
+}
+
+void errUserOnChannel(Client *to, const StringView &nick, const StringView &channel)
+{
+	ReplyBuilder(to, "443").param(nick).param(channel).trailing("is already on channel").send();
+}
+
+void errNotRegistered(Client *to)
+{
+	ReplyBuilder(to, "451").trailing("You have not registered").send();
+}
+
+void errNeedMoreParams(Client *to, const StringView &command)
+{
+	ReplyBuilder(to, "461").param(command).trailing("Not enough parameters").send();
+}
+
+void errAlreadyRegistred(Client *to)
+{
+	ReplyBuilder(to, "462").trailing("Unauthorized command (already registered)").send();
+}
+
+void errPasswdMismatch(Client *to)
+{
+	ReplyBuilder(to, "464").trailing("Password incorrect").send();
+}
+
+void errKeySet(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "467").param(channel).trailing("Channel key already set").send();
+}
+
+void errChannelIsFull(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "471").param(channel).trailing("Cannot join channel (+l)").send();
+}
+
+void errUnknownMode(Client *to, char mode, const StringView &channel)
+{
+	ReplyBuilder(to, "472").param(StringView(&mode, 1))
+		.trailing("is unknown mode char to me for ").raw(channel).send();
+}
+
+void errInviteOnlyChan(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "473").param(channel).trailing("Cannot join channel (+i)").send();
+}
+
+void errBadChannelKey(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "475").param(channel).trailing("Cannot join channel (+k)").send();
+}
+
+void errChanOPrivsNeeded(Client *to, const StringView &channel)
+{
+	ReplyBuilder(to, "482").param(channel).trailing("You're not channel operator").send();
+}
@@ -16,12 +16,54 @@
 #include "client.hpp"
 #include "channel.hpp"
 
-Server::Server(int port, const std::string &pass): _port(port), _pass(pass), _server_fd(-1)
+__thread Server* Server::_current = NULL;
+__thread std::vector<int>* Server::_flushList = NULL;
+
+ServerState::ServerState(bool threaded) : fanoutEpoch(0), stopping(0), threaded(threaded)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+// Runs after every reactor has stopped and freed its clients
+ServerState::~ServerState()
+{
+    for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ++it)
+        delete it->second;
+    pthread_mutex_destroy(&mutex);
+}
+
+void ServerState::lock()
+{
+    if (threaded)
+        pthread_mutex_lock(&mutex);
+}
+
+void ServerState::unlock()
+{
+    if (threaded)
+        pthread_mutex_unlock(&mutex);
+}
+
+// Ends every event loop (after a fatal error in one of them, or SIGINT)
+void ServerState::stopAll()
+{
+    __sync_lock_test_and_set(&stopping, 1);
+    for (size_t i = 0; i < reactors.size(); i++)
+        reactors[i]->wake();
+}
+
+Server::Server(int port, const std::string &pass, ServerState &state)
+    : _port(port), _pass(pass), _epoll_fd(-1), _server_fd(-1), _spare_fd(-1), _wake_fd(-1),
+      _state(state), _nicks(state.nicks), _channels(state.channels), _fanoutEpoch(state.fanoutEpoch),
+      _inbox(NULL),
+      _draining(false)
 {
+    state.reactors.push_back(this);
 }
 
 Server::~Server()
 {
+    cleanup();
 }
 
 void Server::cleanup()
@@ -31,23 +73,21 @@ void Server::cleanup()
     {
         if (*it != NULL)
         {
-            // close socket client
-            close((*it)->getFd());
-            
-            // delete client object
+            // delete client object (the destructor closes the socket)
             delete *it;
         }
     }
     
-    // clean vector
+    // clean table (the channels and the nick index belong to ServerState)
     _clients.clear();
-    
-    // channels cleanup
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+    _clientSlots.clear();
+    while (_inbox)
     {
-        delete it->second;
+        InboxNode* node = _inbox;
+        _inbox = node->next;
+        delete node;
     }
-    _channels.clear();
+    Log::flush();
     
     // close socket server
     if (_server_fd != -1)
@@ -55,9 +95,40 @@ void Server::cleanup()
         close(_server_fd);
         _server_fd = -1;
     }
+
+    if (_spare_fd != -1)
+    {
+        close(_spare_fd);
+        _spare_fd = -1;
+    }
+
+    if (_wake_fd != -1)
+    {
+        close(_wake_fd);
+        _wake_fd = -1;
+    }
+
+    // close epoll instance
+    if (_epoll_fd != -1)
+    {
+        close(_epoll_fd);
+        _epoll_fd = -1;
+    }
 }
 
+// Single reactor: everything runs on the calling thread
 void	Server::start()
+{
+	setup();
+	run();
+	// Clean up: close sockets, free memory, etc.
+	cleanup();
+}
+
+// Listener and epoll instance of this reactor. With several reactors each
+// one binds its own listener with SO_REUSEPORT and the kernel spreads the
+// incoming connections over them.
+void	Server::setup()
 {
 	_server_fd = socket(AF_INET, SOCK_STREAM, 0);//creates socket
 	if (_server_fd == -1)
@@ -68,6 +139,8 @@ void	Server::start()
 	if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)))
 		throw std::runtime_error("Error while setting socket options");
 	//this sets option for the socket to reuse local adress
+	if (_state.threaded && setsockopt(_server_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)))
+		throw std::runtime_error("Error while setting socket options");
 	sockaddr_in server_addr;
 	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET; //sets adress family to use IPv4
@@ -78,175 +151,444 @@ void	Server::start()
 	if (listen(_server_fd, SOMAXCONN) == -1)//constant that specifies max allowed queued connections
         throw std::runtime_error("Failed to listen on socket");
 	
-	std::cout << "Server started on port " << _port << std::endl;	
+	if (this == _state.reactors[0])
+		LOG_INFO(LOG_SERVER) << "Server started on port " << _port;	
 
-	// Vector for pollfd structures
-	std::vector<struct pollfd> pollfds;
-	
-	// add server socket to vector of pollfds
-	struct pollfd server_pfd;
-	server_pfd.fd = _server_fd;
-	server_pfd.events = POLLIN; // Monitor for incoming connections
-	server_pfd.revents = 0;
-	pollfds.push_back(server_pfd);
+	_epoll_fd = epoll_create1(0);
+	if (_epoll_fd == -1)
+		throw std::runtime_error("Failed to create epoll instance");
+	addToEpoll(_server_fd); // Monitor for incoming connections
+	for (unsigned int id = 0; id < CMD_COUNT; id++)
+		Trace::nameCommand(id, _commands[id].name);
+	_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC); // see shedConnection()
+	if (_state.threaded)
+	{
+		// other reactors post messages for our clients, see post()
+		_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_wake_fd == -1)
+			throw std::runtime_error("Failed to create eventfd");
+		addToEpoll(_wake_fd);
+	}
+}
+
+void	Server::run()
+{
+	_current = this;
+	// Ready events are collected here; the vector grows when a wait fills it
+	std::vector<struct epoll_event> events(EPOLL_MAX_EVENTS);
 	
-	while (g_running)
+	while (isRunning())
 	{
-		// we call poll() only here.
-		int ret = poll(pollfds.data(), pollfds.size(), -1); // -1 = espera indefinidamente
+		// we call epoll_wait() only here (it only blocks when no queued
+		// input is waiting on the flood bucket, see inputWaitTimeout(),
+		// and no channel broadcast is still being delivered in slices)
+		int timeout = (_deadClients.empty() && !Channel::hasBacklog()) ? inputWaitTimeout() : 0;
+		int ret = epoll_wait(_epoll_fd, events.data(), events.size(), timeout);
 		
 		if (ret == -1)
 		{
 			if (errno == EINTR)
 				continue;
-			throw std::runtime_error("poll failed");
+			throw std::runtime_error("epoll_wait failed");
 		}
+		Log::tick();
 		
-		// working on file descriptors
-		for (size_t i = 0; i < pollfds.size(); i++)
+		// working on every ready file descriptor in one pass
+		for (int i = 0; i < ret; i++)
 		{
-			if (pollfds[i].revents & POLLIN)
+			int fd = events[i].data.fd;
+			uint32_t revents = events[i].events;
+
+			if (fd == _server_fd)
+			{
+				// new connection in server socket
+				// (registered with epoll inside acceptClient)
+				acceptClient();
+				continue;
+			}
+			if (fd == _wake_fd)
+			{
+				drainInbox();
+				continue;
+			}
+
+			// client may have been dropped earlier in this batch
+			Client* client = getClientByFd(fd);
+			if (client == NULL || client->isDead())
+				continue;
+
+			if (revents & EPOLLOUT)
 			{
-				if (pollfds[i].fd == _server_fd)
-				{
-					// new connection in server socket
-					acceptClient();
-					
-					// refresh vector of pollfds with new client
-					// (made inside acceptClient)
-					rebuildPollFds(pollfds);
-				}
-				else
-				{
-					// data received from a client
-					handleClient(pollfds[i].fd);
-					
-					// if client removed, reconstruct vector
-					if (getClientByFd(pollfds[i].fd) == NULL)
-					{
-						rebuildPollFds(pollfds);
-						break; // exit loop for and restart
-					}
-				}
+				// socket drained, send what is still queued
+				client->flushOutput();
 			}
-			else if (pollfds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+			if (revents & EPOLLIN)
+			{
+				// data received from a client
+				handleClient(fd);
+			}
+			else if (revents & (EPOLLHUP | EPOLLERR))
 			{
 				// client disconnected or error
-				std::cout << "Client disconnected or error on fd: " << pollfds[i].fd << std::endl;
-				
-				// remove client
-				for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-				{
-					if ((*it)->getFd() == pollfds[i].fd)
-					{
-                        removeClientFromAllChannels(*it);
-						close(pollfds[i].fd);
-						delete *it;
-						_clients.erase(it);
-						break;
-					}
-				}
-				
-				// reconstruct vector of pollfds
-				rebuildPollFds(pollfds);
-				break; // exit loop and restart
+				LOG_INFO(LOG_CLIENT) << "Client disconnected or error on fd: " << fd;
+				disconnectClient(client, "Client disconnected");
 			}
 		}
+		// one turn for every client with lines waiting, one slice of every
+		// large broadcast still in progress, then the clients that left
+		// this tick are removed, and finally one write per client for
+		// everything queued during this tick
+		processPendingInput();
+		if (Channel::hasBacklog())
+		{
+			StateLock lock(_state);
+			Channel::advanceBacklogs();
+		}
+		reapDeadClients();
+		flushPendingClients();
+		// log lines written while handling this batch go out in one write()
+		Log::flush();
+		if (static_cast<size_t>(ret) == events.size())
+			events.resize(events.size() * 2);
 	}
-	
-    // Clean up: close sockets, free memory, etc.
-    cleanup();
 }
 
-void Server::removeClientFromAllChannels(Client* client)
+// SIGINT is only delivered to the first reactor's thread (the main one);
+// the others learn about it from stopAll()
+bool Server::isRunning()
+{
+    if (this == _state.reactors[0] && !g_running)
+        return false;
+    return !__sync_fetch_and_add(&_state.stopping, 0);
+}
+
+// Called from another reactor's thread: the message is pushed onto our
+// inbox without a lock, and the eventfd is only written when the inbox
+// was empty (otherwise a wake-up is already pending)
+void Server::post(Client* client, const SharedMessage &message, bool relayed)
+{
+    InboxNode* node = new InboxNode;
+    node->fd = client->getFd();
+    node->serial = client->getSerial();
+    node->message = message;
+    node->relayed = relayed;
+    InboxNode* head = NULL;
+    while (true)
+    {
+        node->next = head;
+        InboxNode* seen = __sync_val_compare_and_swap(&_inbox, head, node);
+        if (seen == head)
+            break;
+        head = seen;
+    }
+    if (head == NULL)
+        wake();
+}
+
+void Server::wake()
+{
+    if (_wake_fd == -1)
+        return;
+    uint64_t one = 1;
+    ssize_t ret = write(_wake_fd, &one, sizeof(one));
+    (void)ret; // EAGAIN: the counter is already non-zero
+}
+
+void Server::drainInbox()
+{
+    uint64_t count;
+    ssize_t ret = read(_wake_fd, &count, sizeof(count));
+    (void)ret;
+    deliverInbox();
+}
+
+// Takes the whole inbox in one swap (so there is no ABA to worry about) and
+// queues the messages in the order they were posted
+void Server::deliverInbox()
+{
+    InboxNode* node = __sync_lock_test_and_set(&_inbox, static_cast<InboxNode*>(NULL));
+    InboxNode* ordered = NULL;
+    while (node)
+    {
+        InboxNode* next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+    _draining = true;
+    while (ordered)
+    {
+        InboxNode* next = ordered->next;
+        Client* client = getClientByFd(ordered->fd);
+        if (client && client->getSerial() == ordered->serial && !client->isDead()
+            && !(ordered->relayed && client->isSendQThrottled()))
+            client->sendMessage(ordered->message);
+        delete ordered;
+        ordered = next;
+    }
+    _draining = false;
+}
+
+// Called before we queue output for one of our clients directly. Another
+// reactor may have posted to the same client earlier (a channel backlog is
+// advanced by whichever reactor gets there first), and that has to go out
+// first. Fan-out workers skip it: run() catches up before starting them.
+void Server::catchUpInbox()
+{
+    if (!_state.threaded || _draining || _flushList)
+        return;
+    if (__sync_val_compare_and_swap(&_inbox, static_cast<InboxNode*>(NULL),
+            static_cast<InboxNode*>(NULL)) != NULL)
+        deliverInbox();
+}
+
+void Server::removeClientFromAllChannels(Client* client, const std::string &reason)
 {
     if (!client) return;
     
-    std::vector<std::string> channels = client->getChannels();
-    
-    for (std::vector<std::string>::iterator it = channels.begin(); it != channels.end(); ++it)
+    sendToPeers(client, SharedMessage(new std::string(client->relayMessage("QUIT", "", reason))));
+
+    // removeMember unlinks the channel from the client's list as well
+    const std::vector<Channel*>& channels = client->getChannels();
+    while (!channels.empty())
     {
-        std::string channelName = *it;
+        Channel* channel = channels.back();
+        channel->removeMember(client);
         
-        std::map<std::string, Channel*>::iterator channelIt = _channels.find(channelName);
-        if (channelIt != _channels.end())
+        if (channel->getMemberCount() == 0)
         {
-            Channel* channel = channelIt->second;
-            
-            std::string quitMsg = ":" + client->getNick() + "!" + client->getUser() + "@" + client->getHost() + " QUIT :Client disconnected\r\n";
-            channel->broadcastMessage(quitMsg, client);
-            
-            channel->removeMember(client);
-            
-            if (channel->getMemberCount() == 0)
+            _channels.erase(channel->getName());
+            delete channel;
+        }
+    }
+}
+
+// Sends the message once to everyone sharing at least one channel with the
+// client, however many channels they share. Broadcasts still being sliced
+// into those channels are completed first, so that a NICK or QUIT does not
+// arrive before what the client (or anyone) said in the channel earlier.
+void Server::sendToPeers(Client* client, const SharedMessage &message)
+{
+    const std::vector<Channel*>& channels = client->getChannels();
+    for (std::vector<Channel*>::const_iterator chan_it = channels.begin();
+         chan_it != channels.end(); ++chan_it)
+        (*chan_it)->finishBacklog();
+    unsigned long fanout = ++_fanoutEpoch;
+    client->markFanout(fanout);
+    for (std::vector<Channel*>::const_iterator chan_it = channels.begin();
+         chan_it != channels.end(); ++chan_it)
+    {
+        const Channel::MemberList& members = (*chan_it)->getMembers();
+        for (Channel::MemberList::const_iterator it = members.begin(); it != members.end(); ++it)
+        {
+            if ((*it)->markFanout(fanout))
+                (*it)->sendMessage(message);
+        }
+    }
+}
+
+// Every way a client leaves ends here: it is only flagged, and the actual
+// removal happens in reapDeadClients() once nothing else in the tick can
+// still be holding on to it
+void Server::disconnectClient(Client* client, const std::string &reason)
+{
+    if (client->markDead(reason))
+        _deadClients.push_back(client);
+}
+
+// End-of-tick teardown of the clients that left: QUIT to their channels,
+// channel and invite cleanup, a last flush (the closing ERROR line), then
+// the fd is closed and the client freed.
+//
+// The QUIT is channel state, so unlike relayed chat it is queued for peers
+// past SENDQ_SOFT_LIMIT too. A peer close to SENDQ_HARD_LIMIT can be pushed
+// over it and dropped by the flush that follows, and its own QUIT goes out
+// on the next tick: when a whole channel is slow, sendQ drops can cascade
+// through it, one hop per loop iteration.
+void Server::reapDeadClients()
+{
+    if (_deadClients.empty())
+        return;
+    {
+        // once out of the shared state no other reactor can reach them
+        StateLock lock(_state);
+        bool invites = false;
+        for (size_t i = 0; i < _deadClients.size(); i++)
+        {
+            Client* client = _deadClients[i];
+            removeClientFromAllChannels(client, client->getQuitReason());
+            invites = invites || client->wasInvited();
+            if (!client->getNick().empty() && getClientByNick(client->getNick()) == client)
+                _nicks.erase(client->getNick());
+        }
+        // invites are the only place a channel refers to a non-member
+        if (invites)
+        {
+            for (std::map<std::string, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it)
             {
-                delete channel;
-                _channels.erase(channelIt);
+                for (size_t i = 0; i < _deadClients.size(); i++)
+                {
+                    if (_deadClients[i]->wasInvited())
+                        it->second->removeInvite(_deadClients[i]);
+                }
             }
         }
     }
-    
-    client->clearChannels();
+    for (size_t i = 0; i < _deadClients.size(); i++)
+    {
+        Client* client = _deadClients[i];
+        if (client->isSendQExceeded())
+            client->abortOutput("ERROR :" + client->getQuitReason() + "\r\n");
+        else
+            client->flushOutput();
+        Trace::record(TRACE_DISCONNECT, client->getFd(), client->getOutBytes());
+        removeFromEpoll(client->getFd());
+        removeClient(client);
+        delete client; // the destructor closes the socket
+    }
+    _deadClients.clear();
 }
 
-// new function to reconstruct vector of pollfds
-void Server::rebuildPollFds(std::vector<struct pollfd>& pollfds)
+void Server::addToEpoll(int fd)
 {
-	pollfds.clear();
-	
-	// add server socket
-	struct pollfd server_pfd;
-	server_pfd.fd = _server_fd;
-	server_pfd.events = POLLIN;
-	server_pfd.revents = 0;
-	pollfds.push_back(server_pfd);
-	
-	// add all the socket client
-	for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		throw std::runtime_error("Failed to register fd with epoll: " + std::string(strerror(errno)));
+}
+
+void Server::watchEvents(int fd, bool readable, bool writable)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = 0;
+	if (readable)
+		ev.events |= EPOLLIN;
+	if (writable)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+	epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void Server::scheduleFlush(Client* client)
+{
+	if (_flushList)
+		_flushList->push_back(client->getFd());
+	else
+		_pendingFlush.push_back(client->getFd());
+}
+
+void Server::scheduleFlushes(const std::vector<int> &fds)
+{
+	_pendingFlush.insert(_pendingFlush.end(), fds.begin(), fds.end());
+}
+
+// A fan-out worker queues output for the reactor's clients while the
+// reactor waits for it; the flushes it schedules go to its own list
+void Server::enterFanout(Server* reactor, std::vector<int>* flushList)
+{
+	_current = reactor;
+	_flushList = flushList;
+}
+
+void Server::flushPendingClients()
+{
+	// fds are re-resolved: a client may have left after queueing data
+	for (size_t i = 0; i < _pendingFlush.size(); i++)
 	{
-		struct pollfd client_pfd;
-		client_pfd.fd = (*it)->getFd();
-		client_pfd.events = POLLIN;
-		client_pfd.revents = 0;
-		pollfds.push_back(client_pfd);
+		Client* client = getClientByFd(_pendingFlush[i]);
+		if (!client || client->isDead())
+			continue;
+		if (client->isSendQExceeded())
+			dropClient(client, "SendQ exceeded");
+		else
+			client->flushOutput();
 	}
+	_pendingFlush.clear();
 }
 
-void Server::acceptClient() {
-    sockaddr_in client_addr;
-    memset(&client_addr, 0, sizeof(client_addr));
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(_server_fd, (struct sockaddr*)&client_addr, &client_len);
-    if (client_fd == -1) {
-        std::cerr << "Failed to accept client: " << strerror(errno) << std::endl;
-        return;
-    }
+// Server-side disconnect with a last ERROR line. A client over its sendQ
+// gets it when reaped, after its queue is discarded.
+void Server::dropClient(Client* client, const std::string &reason)
+{
+	LOG_WARN(LOG_CLIENT) << "Client " << client->getNick() << " (fd: " << client->getFd()
+			  << ") disconnected: " << reason;
+	Trace::record(TRACE_DROP, client->getFd(), client->getOutBytes());
+	if (!client->isSendQExceeded())
+		client->sendMessage("ERROR :" + reason + "\r\n");
+	disconnectClient(client, reason);
+}
 
-    // Log the accepted client
-    std::cout << "Accepted client with fd: " << client_fd << std::endl;
+void Server::removeFromEpoll(int fd)
+{
+	// the kernel drops closed fds on its own, this keeps the set exact meanwhile
+	epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
 
-    // Set the client socket to non-blocking mode
-    if (fcntl(client_fd, F_SETFL, O_NONBLOCK) == -1) {
-        std::cerr << "Failed to set non-blocking mode for client: " << strerror(errno) << std::endl;
-        close(client_fd);
-        return;
-    }
+// Accepts every pending connection until the backlog is empty, so a burst
+// of reconnects is taken in one wake-up of the listener. accept4() hands the
+// sockets over already non-blocking and close-on-exec.
+void Server::acceptClient() {
+    while (true)
+    {
+        sockaddr_in client_addr;
+        memset(&client_addr, 0, sizeof(client_addr));
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(_server_fd, (struct sockaddr*)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if ((errno == EMFILE || errno == ENFILE) && shedConnection())
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR(LOG_SERVER) << "Failed to accept client: " << strerror(errno);
+            return;
+        }
 
-    // Create a new Client object and add it to the list
-	char ipstr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, ipstr, sizeof(ipstr));
-	Client* client = new Client(client_fd);
-	client->setHost(std::string(ipstr));
-    _clients.push_back(client);
-    std::cout << "New client connected: " << client_fd << std::endl;
-	//attempting to avoid instant disconnection
-    try {
-        _clients.back()->sendMessage(":irc.local NOTICE * :Hello! Make sure you're registered and authenticated to use the server.\r\n");
-    } catch (const std::exception &e) {
-        std::cerr << "Failed to send welcome message: " << e.what() << std::endl;
+        // Create a new Client object and add it to the list
+        char ipstr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, ipstr, sizeof(ipstr));
+        try {
+            addToEpoll(client_fd);
+        } catch (const std::exception &e) {
+            LOG_ERROR(LOG_SERVER) << e.what();
+            close(client_fd);
+            continue;
+        }
+        Client* client = new Client(client_fd, this);
+        client->setHost(std::string(ipstr));
+        addClient(client);
+        Trace::record(TRACE_ACCEPT, client_fd);
+        LOG_INFO(LOG_CLIENT) << "New client connected: " << client_fd;
+        //attempting to avoid instant disconnection
+        client->sendMessage(":irc.local NOTICE * :Hello! Make sure you're registered and authenticated to use the server.\r\n");
     }
 }
 
+// Out of fds: the pending connection would keep the listener readable and
+// the loop spinning. The spare fd is given up just long enough to accept
+// that connection and close it straight away. Returns false if nothing
+// could be shed, so the accept loop stops instead of retrying.
+bool Server::shedConnection()
+{
+    if (_spare_fd == -1)
+        return false;
+    close(_spare_fd);
+    int fd = accept(_server_fd, NULL, NULL);
+    if (fd != -1)
+        close(fd);
+    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    Trace::record(TRACE_REFUSED, fd);
+    LOG_WARN(LOG_SERVER) << "Out of file descriptors, connection refused";
+    return true;
+}
+
 void Server::handleClient(int client_fd)
 {
     Client* client = getClientByFd(client_fd);
@@ -255,179 +597,283 @@ void Server::handleClient(int client_fd)
     
     try
     {
-        std::string msg = client->receiveMessage();
-        if (msg.empty())
-            return;
-
-        // Accumulate data in the client's buffer
-		client->getBuffer() += msg;
-
-		size_t pos;
-		// Process all complete commands in the buffer
-		while ((pos = client->getBuffer().find("\r\n")) != std::string::npos)
-		{
-			std::string line = client->getBuffer().substr(0, pos);
-			client->getBuffer().erase(0, pos + 2); // Remove processed command
-			parseCommand(client_fd, line);
-            if (client->getShouldQuit())
-            {
-                close(client_fd);
-				// Remover do vector e apagar
-				for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-				{
-					if ((*it)->getFd() == client_fd)
-					{
-						close(client_fd);
-						delete *it;
-						_clients.erase(it);
-						break;
-					}
-				}
-				return; // Sair da função
-			}
-		}
-        // Any leftover in _buff is a partial command, keep it for next time
+        // lines are run after the event batch, see processPendingInput()
+        size_t received = client->receiveMessage();
+        Trace::record(TRACE_READ, client_fd, received);
+        if (received > 0)
+            scheduleInput(client);
     }
     catch (const std::runtime_error &e)
     {
-        std::cout << "Client disconnected: " << e.what() << std::endl;
-        
-        // Remove client from vector
-        for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-        {
-            if ((*it)->getFd() == client_fd)
-            {
-                removeClientFromAllChannels(*it);
-                close(client_fd);
-                delete *it;
-                _clients.erase(it);
-                break;
-            }
-        }
+        LOG_INFO(LOG_CLIENT) << "Client disconnected: " << e.what();
+        disconnectClient(client, "Client disconnected");
     }
 }
 
-Client* Server::getClientByFd(int fd)
+void Server::scheduleInput(Client* client)
 {
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-    {
-        if ((*it)->getFd() == fd)
-            return *it;
-    }
-    return NULL;
+    if (client->isInputScheduled())
+        return;
+    client->setInputScheduled(true);
+    _pendingInput.push_back(client->getFd());
 }
 
-std::string Server::cleanInput(const std::string &input, const std::string &toRemove)
+// Gives every client with buffered lines one turn: each runs at most
+// INPUT_TICK_BUDGET commands, so a client pipelining thousands of lines
+// is interleaved with everyone else instead of holding up the loop
+void Server::processPendingInput()
 {
-    std::string result = input;
-    
-    size_t start = result.find_first_not_of(" \t\r\n");
-    if (start != std::string::npos)
-        result = result.substr(start);
-    size_t end = result.find_last_not_of(toRemove + " \t\r\n");
-    if (end != std::string::npos)
-        result = result.substr(0, end + 1);
-    
-    return result;
+    std::vector<int> ready;
+    ready.swap(_pendingInput);
+    for (size_t i = 0; i < ready.size(); i++)
+    {
+        // fds are re-resolved: a client may have left during this pass
+        Client* client = getClientByFd(ready[i]);
+        if (!client || client->isDead() || !client->isInputScheduled())
+            continue;
+        client->setInputScheduled(false);
+        processInput(client);
+    }
 }
 
-void Server::parseCommand(int client_fd, const std::string &command)
+void Server::processInput(Client* client)
 {
-    if (command.empty() || command == "\r\n")
-        return;
-    
-    const char* commands[] = {
-        "JOIN", "PART", "KICK", "INVITE", "TOPIC", "MODE",
-        "PASS", "NICK", "USER", "PRIVMSG", "QUIT", "WHO", "CAP"
-    };
-    const int numCommands = 13;
-    
-    Client* client = getClientByFd(client_fd);
-    if (!client)
-        return;
-    
-    std::string upperCommand = command;
-    std::transform(upperCommand.begin(), upperCommand.end(), upperCommand.begin(), ::toupper);
-    int cmdIndex = -1;
-    std::string foundCommand;
-    std::string restOfCommand;
-    
-    for (int i = 0; i < numCommands; i++)
+    int client_fd = client->getFd();
+    const char* data = client->getBuffer();
+    size_t size = client->getBufferSize();
+    size_t start = 0;
+    unsigned int budget = INPUT_TICK_BUDGET;
+    unsigned long now = monotonicMs();
+    const char* crlf = NULL;
+    // Process complete commands while the budget and the flood bucket allow
+    while (budget > 0 && client->floodDelay(now) == 0
+        && (crlf = static_cast<const char*>(memmem(data + start, size - start, "\r\n", 2))) != NULL)
     {
-        size_t pos = upperCommand.find(commands[i]);
-        if (pos != std::string::npos)
+        // the line is handed over as a view into the input buffer, no copy
+        StringView line(data + start, crlf - (data + start));
+        start += line.size() + 2;
+        if (client->isDiscardingLine())
         {
-            // Check if it's a complete command (followed by space or end of string)
-            size_t cmdLen = strlen(commands[i]);
-            if (pos + cmdLen == upperCommand.length() || 
-                upperCommand[pos + cmdLen] == ' ' || 
-                upperCommand[pos + cmdLen] == '\r' ||
-                upperCommand[pos + cmdLen] == '\n')
-            {
-                cmdIndex = i;
-                foundCommand = commands[i];
-                // Extract parameters after the command
-                if (pos + cmdLen < command.length())
-                    restOfCommand = command.substr(pos + cmdLen);
-                break;
-            }
+            // tail of an overlong line, already answered
+            client->setDiscardingLine(false);
+            continue;
+        }
+        budget--;
+        if (line.size() > maxLineLength(line))
+        {
+            client->spendFloodTokens(1);
+            rejectLongLine(client);
+            if (client->isDead())
+                return;
+            continue;
+        }
+        uint64_t started = Trace::clock();
+        unsigned int command;
+        {
+            StateLock lock(_state);
+            command = parseCommand(client_fd, line);
         }
+        Trace::record(TRACE_COMMAND, client_fd, line.size(), command, Trace::clock() - started);
+        if (client->isDead())
+            return; // QUIT: the rest of its input is dropped with it
     }
-    
-    if (cmdIndex != -1)
+    if (memmem(data + start, size - start, "\r\n", 2) != NULL)
     {
-        if (foundCommand == "PASS" || foundCommand == "QUIT" || foundCommand == "NICK")
-            restOfCommand = cleanInput(restOfCommand, " \t");
-        else
-            restOfCommand = cleanInput(restOfCommand, "\r\n");
+        // out of budget or tokens: the remaining lines wait for a later turn
+        scheduleInput(client);
     }
-    std::cout << "Command: [" << foundCommand << "]" << std::endl;
-    std::cout << "Parameters: [" << restOfCommand << "]" << std::endl;
-    switch (cmdIndex)
+    else
+    {
+        // no CRLF yet and already past the limit: drop what we have of the
+        // line and skip the rest of it as it arrives
+        StringView partial(data + start, size - start);
+        if (partial.size() > maxLineLength(partial))
+        {
+            if (!client->isDiscardingLine())
+                rejectLongLine(client);
+            if (client->isDead())
+                return;
+            client->setDiscardingLine(true);
+        }
+        if (client->isDiscardingLine() && start < size)
+        {
+            // keep a trailing '\r' so a CRLF split across reads is still found
+            start = size - (data[size - 1] == '\r');
+        }
+    }
+    client->consumeBuffer(start); // Remove processed commands
+    // Any leftover in _buff waits for its turn (or is a partial command);
+    // a full backlog stops reading from the socket until it shrinks
+    client->setReadPaused(client->getBufferSize() >= INPUT_BUFFER_CAP);
+}
+
+// epoll_wait() timeout: block while no client has lines waiting, poll when
+// one can run now, otherwise sleep until the first throttled client has
+// earned a token again
+int Server::inputWaitTimeout()
+{
+    if (_pendingInput.empty())
+        return -1;
+    unsigned long now = monotonicMs();
+    unsigned long wait = 0;
+    for (size_t i = 0; i < _pendingInput.size(); i++)
+    {
+        Client* client = getClientByFd(_pendingInput[i]);
+        if (!client)
+            continue;
+        unsigned long delay = client->floodDelay(now);
+        if (delay == 0)
+            return 0;
+        if (wait == 0 || delay < wait)
+            wait = delay;
+    }
+    return wait == 0 ? -1 : static_cast<int>(wait);
+}
+
+// ERR_INPUTTOOLONG for a line over the limit; a client that keeps doing it
+// is dropped
+void Server::rejectLongLine(Client* client)
+{
+    if (client->addInputBreach() >= MAX_INPUT_BREACHES)
+        dropClient(client, "Input line too long");
+    else
+        errInputTooLong(client);
+}
+
+Client* Server::getClientByFd(int fd)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _clientSlots.size() || _clientSlots[fd] == -1)
+        return NULL;
+    return _clients[_clientSlots[fd]];
+}
+
+void Server::addClient(Client* client)
+{
+    int fd = client->getFd();
+    if (static_cast<size_t>(fd) >= _clientSlots.size())
+        _clientSlots.resize(fd + 1, -1);
+    _clientSlots[fd] = _clients.size();
+    _clients.push_back(client);
+}
+
+Client* Server::getClientByNick(const std::string &nick)
+{
+    std::tr1::unordered_map<std::string, Client*, IrcCaseHash, IrcCaseEqual>::iterator it = _nicks.find(nick);
+    return it != _nicks.end() ? it->second : NULL;
+}
+
+// Unlinks the client from the table in O(1): the last entry takes its slot
+void Server::removeClient(Client* client)
+{
+    int fd = client->getFd();
+    if (fd < 0 || static_cast<size_t>(fd) >= _clientSlots.size() || _clientSlots[fd] == -1)
+        return;
+    int index = _clientSlots[fd];
+    Client* last = _clients.back();
+    _clients[index] = last;
+    _clientSlots[last->getFd()] = index;
+    _clients.pop_back();
+    _clientSlots[fd] = -1;
+}
+
+// Indexed by CommandId
+const Server::Command Server::_commands[CMD_COUNT] = {
+    // name       handler                    registered  minParams  cost
+    { "JOIN",     &Server::joinCommand,      true,       1,         3 },
+    { "PART",     &Server::partCommand,      true,       1,         1 },
+    { "KICK",     &Server::kickCommand,      true,       2,         2 },
+    { "INVITE",   &Server::inviteCommand,    true,       2,         2 },
+    { "TOPIC",    &Server::topicCommand,     true,       1,         1 },
+    { "MODE",     &Server::modeCommand,      true,       1,         2 },
+    { "PASS",     &Server::passCommand,      false,      1,         1 },
+    { "NICK",     &Server::nickCommand,      false,      0,         2 }, // replies 431 itself
+    { "USER",     &Server::userCommand,      false,      4,         1 },
+    { "PRIVMSG",  &Server::privmsgCommand,   true,       0,         1 }, // replies 411/412 itself
+    { "QUIT",     &Server::quitCommand,      false,      0,         0 },
+    { "WHO",      &Server::whoCommand,       true,       0,         4 }, // one reply per member
+    { "CAP",      NULL,                      false,      0,         1 }
+};
+
+// Constant-time lookup: switch on the name length and first letter, then a
+// single case-insensitive compare confirms the candidate
+const Server::Command* Server::findCommand(const StringView &name)
+{
+    if (name.empty())
+        return NULL;
+    int index = -1;
+    char first = std::toupper(static_cast<unsigned char>(name[0]));
+    switch (name.size())
     {
-        case 0:
-            joinCommand(client_fd, restOfCommand);
-            break;
-        case 1:
-            partCommand(client_fd, restOfCommand);
-            break;
-        case 2:
-            kickCommand(client_fd, restOfCommand);
-            break;
         case 3:
-            inviteCommand(client_fd, restOfCommand);
+            if (first == 'W')
+                index = CMD_WHO;
+            else if (first == 'C')
+                index = CMD_CAP;
             break;
         case 4:
-            topicCommand(client_fd, restOfCommand);
+            switch (first)
+            {
+                case 'J': index = CMD_JOIN; break;
+                case 'K': index = CMD_KICK; break;
+                case 'M': index = CMD_MODE; break;
+                case 'N': index = CMD_NICK; break;
+                case 'Q': index = CMD_QUIT; break;
+                case 'U': index = CMD_USER; break;
+                case 'P': // PART / PASS
+                    index = (std::toupper(static_cast<unsigned char>(name[3])) == 'T') ? CMD_PART : CMD_PASS;
+                    break;
+            }
             break;
         case 5:
-            modeCommand(client_fd, restOfCommand);
+            if (first == 'T')
+                index = CMD_TOPIC;
             break;
         case 6:
-            passCommand(client_fd, restOfCommand);
+            if (first == 'I')
+                index = CMD_INVITE;
             break;
         case 7:
-            nickCommand(client_fd, restOfCommand);
-            break;
-        case 8:
-            userCommand(client_fd, restOfCommand);
-            break;
-        case 9:
-            privmsgCommand(client_fd, restOfCommand);
-            break;
-        case 10:
-            quitCommand(client_fd, restOfCommand);
-            break;
-        case 11:
-            whoCommand(client_fd, restOfCommand);
-            break;
-		case 12:
-			break;
-        default:
-            // Unknown command
-            sendError(client_fd, "421 " + client->getNick() + " " + foundCommand + " :Unknown command");
+            if (first == 'P')
+                index = CMD_PRIVMSG;
             break;
     }
+    if (index == -1 || !name.iequals(_commands[index].name))
+        return NULL;
+    return &_commands[index];
+}
+
+unsigned int Server::parseCommand(int client_fd, const StringView &line)
+{
+    IrcMessage msg;
+    if (!parseMessage(line, msg))
+        return CMD_COUNT;
+    
+    Client* client = getClientByFd(client_fd);
+    if (!client)
+        return CMD_COUNT;
+    
+    LOG_DEBUG(LOG_COMMAND) << "fd " << client_fd << ": [" << msg.command
+        << "] [" << msg.rawParams << "]";
+    const Command* cmd = findCommand(msg.command);
+    client->spendFloodTokens(cmd ? cmd->cost : 1);
+    if (!cmd)
+    {
+        errUnknownCommand(client, msg.command);
+        return CMD_COUNT;
+    }
+    if (cmd->needsRegistration && !client->isAuthenticated())
+    {
+        errNotRegistered(client);
+        return cmd - _commands;
+    }
+    if (msg.paramCount < cmd->minParams)
+    {
+        errNeedMoreParams(client, cmd->name);
+        return cmd - _commands;
+    }
+    if (cmd->handler)
+        (this->*cmd->handler)(client, msg);
+    return cmd - _commands;
 }
 
 void Server::sendError(int client_fd, const std::string &error)
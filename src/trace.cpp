@@ -0,0 +1,79 @@
+#include "trace.hpp"
+#include "log.hpp"
+#include <sys/mman.h>
+#include <cstdio>
+
+TraceHeader *Trace::_header = NULL;
+TraceRecord *Trace::_records = NULL;
+size_t Trace::_size = 0;
+uint64_t Trace::_start = 0;
+
+/**
+ * @brief Creates the trace file and maps it
+ *
+ * @param path File to record into; NULL or "" leaves tracing off. A file
+ *        already there (the trace of the previous run, maybe of a crash)
+ *        is kept as <path>.prev.
+ * @return false if the file could not be set up (the server runs untraced)
+ */
+bool Trace::open(const char *path)
+{
+	if (!path || !*path)
+		return false;
+	std::string prev = std::string(path) + ".prev";
+	if (rename(path, prev.c_str()) == -1 && errno != ENOENT)
+		LOG_WARN(LOG_SERVER) << "Cannot keep the previous trace as " << prev << ": " << strerror(errno);
+	size_t size = sizeof(TraceHeader) + sizeof(TraceRecord) * TRACE_RECORDS;
+	int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1 || ftruncate(fd, size) == -1)
+	{
+		LOG_WARN(LOG_SERVER) << "Trace disabled, cannot create " << path << ": " << strerror(errno);
+		if (fd != -1)
+			::close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd); // the mapping keeps the file
+	if (map == MAP_FAILED)
+	{
+		LOG_WARN(LOG_SERVER) << "Trace disabled, cannot map " << path << ": " << strerror(errno);
+		return false;
+	}
+	// the file starts out zeroed: every record has seq 0 and no names are set
+	TraceHeader *header = static_cast<TraceHeader *>(map);
+	memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+	header->version = TRACE_VERSION;
+	header->recordSize = sizeof(TraceRecord);
+	header->capacity = TRACE_RECORDS;
+	header->head = 0;
+
+	struct timespec mono;
+	struct timespec real;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	_start = static_cast<uint64_t>(mono.tv_sec) * 1000000000ULL + mono.tv_nsec;
+	header->startRealtime = static_cast<uint64_t>(real.tv_sec) * 1000000000ULL + real.tv_nsec;
+
+	_size = size;
+	_records = reinterpret_cast<TraceRecord *>(header + 1);
+	_header = header;
+	LOG_INFO(LOG_SERVER) << "Tracing to " << path;
+	return true;
+}
+
+// Unmapping does not lose anything: the records are already in the file
+void Trace::close()
+{
+	if (!_header)
+		return;
+	munmap(_header, _size);
+	_header = NULL;
+	_records = NULL;
+}
+
+void Trace::nameCommand(unsigned int id, const char *name)
+{
+	if (!_header || id >= TRACE_MAX_COMMANDS)
+		return;
+	strncpy(_header->commands[id], name, TRACE_NAME_LEN - 1);
+}
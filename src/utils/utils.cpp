@@ -1,4 +1,5 @@
 #include "utils/utils.hpp"
+#include "log.hpp"
 
 std::string toUpper(const std::string& str)
 {
@@ -23,7 +24,46 @@ std::string trim(const std::string& str)
     return str.substr(first, (last - first + 1));
 }
 
+char ircFoldCase(char c)
+{
+    if (c >= 'A' && c <= '^') // A-Z [ \ ] ^
+        return c + ('a' - 'A');
+    return c;
+}
+
+// FNV-1a over the case-folded characters, so no lowered copy is built
+size_t IrcCaseHash::operator()(const std::string &str) const
+{
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        hash ^= static_cast<unsigned char>(ircFoldCase(str[i]));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool IrcCaseEqual::operator()(const std::string &a, const std::string &b) const
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (ircFoldCase(a[i]) != ircFoldCase(b[i]))
+            return false;
+    }
+    return true;
+}
+
 void logMessage(const std::string &message)
 {
-    std::cout << "[LOG] " << message << std::endl;
-}
\ No newline at end of file
+    LOG_INFO(LOG_SERVER) << message;
+}
+
+// Milliseconds on the monotonic clock (unaffected by wall-clock changes)
+unsigned long monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
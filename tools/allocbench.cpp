@@ -0,0 +1,211 @@
+// Heap allocations per PRIVMSG, JOIN and WHO. Clients are socketpair ends
+// registered straight into a Server, the channel is built by their JOINs,
+// and each command goes through parseCommand() as if it had just been read
+// from the socket. operator new is counted around the command only: the
+// output is flushed (and read back from the other ends) outside of it.
+// Exits 1 when a command goes over its per-member byte budget.
+//
+//   ./allocbench [members] [rounds]
+
+#include "server.hpp"
+#include "channel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Heap bytes a command may allocate per channel member before the run fails
+// (`make check`). A PRIVMSG is held to the length of the line each member
+// receives. Measured at about 90 B for JOIN (its broadcast) and 160 B for
+// WHO (one RPL_WHOREPLY per member); a per-recipient segment or a copy of
+// the member list goes well past these.
+#ifndef ALLOC_BUDGET_JOIN
+# define ALLOC_BUDGET_JOIN 128
+#endif
+#ifndef ALLOC_BUDGET_WHO
+# define ALLOC_BUDGET_WHO 256
+#endif
+
+// defined next to main() in src/main.cpp, which is not linked in
+volatile std::sig_atomic_t g_running = 1;
+
+namespace
+{
+	unsigned long g_allocs = 0;
+	unsigned long g_bytes = 0;
+}
+
+void *operator new(std::size_t size) throw(std::bad_alloc)
+{
+	g_allocs++;
+	g_bytes += size;
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](std::size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+	free(p);
+}
+
+class ServerBench
+{
+	public:
+		ServerBench(size_t members);
+		~ServerBench();
+		struct Result
+		{
+			double	allocs;		// per command
+			double	bytes;
+			size_t	received;	// bytes user1 read back after the last round
+		};
+
+		Result measure(const char *name, size_t client, const std::string &line,
+			const std::string &undo, unsigned long rounds);
+
+	private:
+		ServerState			_state;
+		Server				_server;
+		std::vector<int>	_fds;	// our end of each client's socketpair
+		std::vector<int>	_peers;	// the end the replies are read from
+
+		void run(size_t client, const std::string &line);
+		size_t drain();
+};
+
+ServerBench::ServerBench(size_t members) : _state(false), _server(0, "bench", _state)
+{
+	Server::_current = &_server;
+	for (size_t i = 0; i <= members; i++)
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		fcntl(sv[0], F_SETFL, O_NONBLOCK);
+		fcntl(sv[1], F_SETFL, O_NONBLOCK);
+		_server.addClient(new Client(sv[0], &_server));
+		_fds.push_back(sv[0]);
+		_peers.push_back(sv[1]);
+		char nick[32];
+		snprintf(nick, sizeof(nick), "user%lu", static_cast<unsigned long>(i));
+		run(i, "PASS bench");
+		run(i, std::string("NICK ") + nick);
+		run(i, std::string("USER ") + nick + " 0 * :" + nick);
+		// the last client stays out of the channel, it is the one joining
+		if (i < members)
+			run(i, "JOIN #bench");
+		drain();
+	}
+}
+
+ServerBench::~ServerBench()
+{
+	for (size_t i = 0; i < _peers.size(); i++)
+		close(_peers[i]);
+	Server::_current = NULL;
+}
+
+void ServerBench::run(size_t client, const std::string &line)
+{
+	_server.parseCommand(_fds[client], StringView(line));
+}
+
+// Returns what user1 (a member that never sends anything) received
+size_t ServerBench::drain()
+{
+	_server.flushPendingClients();
+	char buf[65536];
+	size_t received = 0;
+	for (size_t i = 0; i < _peers.size(); i++)
+	{
+		ssize_t len;
+		while ((len = read(_peers[i], buf, sizeof(buf))) > 0)
+			if (i == 1)
+				received += len;
+	}
+	Log::flush();
+	return received;
+}
+
+// undo (not counted) puts the channel back as it was, so every round
+// starts from the same state
+ServerBench::Result ServerBench::measure(const char *name, size_t client,
+	const std::string &line, const std::string &undo, unsigned long rounds)
+{
+	unsigned long allocs = 0;
+	unsigned long bytes = 0;
+	Result result;
+	for (unsigned long r = 0; r < rounds; r++)
+	{
+		unsigned long a = g_allocs;
+		unsigned long b = g_bytes;
+		run(client, line);
+		allocs += g_allocs - a;
+		bytes += g_bytes - b;
+		if (!undo.empty())
+			run(client, undo);
+		result.received = drain();
+	}
+	result.allocs = static_cast<double>(allocs) / rounds;
+	result.bytes = static_cast<double>(bytes) / rounds;
+	printf("%-8s %12.1f %14.1f\n", name, result.allocs, result.bytes);
+	return result;
+}
+
+namespace
+{
+	int overBudget(const char *name, double perMember, size_t budget)
+	{
+		bool over = perMember > budget;
+		printf("%-14s %12.1f %10lu%s\n", name, perMember,
+			static_cast<unsigned long>(budget), over ? "  FAIL" : "");
+		return over;
+	}
+}
+
+int main(int ac, char **av)
+{
+	size_t members = ac > 1 ? strtoul(av[1], NULL, 10) : 100;
+	unsigned long rounds = ac > 2 ? strtoul(av[2], NULL, 10) : 1000;
+	if (members < 2 || rounds == 0)
+	{
+		fprintf(stderr, "usage: %s [members] [rounds]\n", av[0]);
+		return 1;
+	}
+	Log::configure("error", NULL);
+	ServerBench bench(members);
+	printf("#bench with %lu members, %lu rounds\n\n", static_cast<unsigned long>(members), rounds);
+	printf("%-8s %12s %14s\n", "command", "allocs/op", "bytes/op");
+	ServerBench::Result privmsg = bench.measure("PRIVMSG", 0,
+		"PRIVMSG #bench :hello, this is a benchmark", "", rounds);
+	ServerBench::Result join = bench.measure("JOIN", members, "JOIN #bench", "PART #bench", rounds);
+	ServerBench::Result who = bench.measure("WHO", 0, "WHO #bench", "", rounds);
+
+	// in a small channel the per-command cost dominates: nothing to compare
+	if (members < 50)
+		return 0;
+	// a broadcast is queued by reference (Client::sendMessage(SharedMessage)):
+	// per recipient the heap should see less than the line itself
+	printf("\nbytes per member    measured     budget\n");
+	int failures = 0;
+	failures += overBudget("PRIVMSG", privmsg.bytes / (members - 1), privmsg.received);
+	failures += overBudget("JOIN", join.bytes / members, ALLOC_BUDGET_JOIN);
+	failures += overBudget("WHO", who.bytes / members, ALLOC_BUDGET_WHO);
+	if (failures)
+		return 1;
+	return 0;
+}
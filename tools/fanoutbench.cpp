@@ -0,0 +1,217 @@
+// Event-loop stall caused by PRIVMSGs into one very large channel, with and
+// without the fan-out pool. Reactor A owns every member of #big (socketpair
+// ends registered straight into it) and runs ticks the way Server::run()
+// does: the command and the broadcast slices under the ServerState lock,
+// then one flush for everything queued. Meanwhile reactor B, on its own
+// thread, runs a cheap command every 100us under the same lock, which
+// shows how long the other reactors wait for their next command while A
+// broadcasts.
+//
+//   ./fanoutbench [members] [rounds] [workers]
+
+#include "server.hpp"
+#include "channel.hpp"
+#include "fanout.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// defined next to main() in src/main.cpp, which is not linked in
+volatile std::sig_atomic_t g_running = 1;
+
+namespace
+{
+	unsigned long nowUs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+	}
+
+	struct Stats
+	{
+		unsigned long	count;
+		unsigned long	total;
+		unsigned long	max;
+
+		Stats() : count(0), total(0), max(0) {}
+		void add(unsigned long us)
+		{
+			count++;
+			total += us;
+			if (us > max)
+				max = us;
+		}
+		unsigned long avg() const { return count ? total / count : 0; }
+	};
+}
+
+class ServerBench
+{
+	public:
+		ServerBench(size_t members);
+		~ServerBench();
+		void measure(const char *name, unsigned long rounds);
+
+	private:
+		ServerState			_state;
+		Server				_a;			// owns the members of #big
+		Server				_b;			// the reactor kept waiting
+		std::vector<int>	_peers;		// A's clients' other ends
+		int					_bFd;
+		int					_bPeer;
+		int					_bRunning;
+		Stats				_bWait;
+
+		int addClient(Server &reactor, const char *nick);
+		void tick(const std::string &line, Stats &stall, Stats &locked);
+		void drain();
+		static void *otherReactor(void *arg);
+};
+
+ServerBench::ServerBench(size_t members) : _state(true), _a(0, "bench", _state),
+	_b(0, "bench", _state), _bFd(-1), _bPeer(-1), _bRunning(0)
+{
+	Server::_current = &_a;
+	char nick[32];
+	for (size_t i = 0; i < members; i++)
+	{
+		snprintf(nick, sizeof(nick), "user%lu", static_cast<unsigned long>(i));
+		int fd = addClient(_a, nick);
+		// a JOIN each would broadcast members^2 / 2 lines: only the first
+		// one creates the channel, the others are added silently
+		if (i == 0)
+			_a.parseCommand(fd, StringView("JOIN #big"));
+		else
+			_state.channels["#big"]->addMember(_a.getClientByFd(fd));
+		drain();
+	}
+	Server::_current = &_b;
+	_bFd = addClient(_b, "other");
+	_bPeer = _peers.back();
+	_peers.pop_back();
+	Server::_current = &_a;
+}
+
+ServerBench::~ServerBench()
+{
+	for (size_t i = 0; i < _peers.size(); i++)
+		close(_peers[i]);
+	close(_bPeer);
+	Server::_current = NULL;
+}
+
+int ServerBench::addClient(Server &reactor, const char *nick)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	{
+		perror("socketpair (raise ulimit -n or use fewer members)");
+		exit(1);
+	}
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	reactor.addClient(new Client(sv[0], &reactor));
+	_peers.push_back(sv[1]);
+	reactor.parseCommand(sv[0], StringView("PASS bench"));
+	reactor.parseCommand(sv[0], StringView(std::string("NICK ") + nick));
+	reactor.parseCommand(sv[0], StringView(std::string("USER ") + nick + " 0 * :" + nick));
+	return sv[0];
+}
+
+// One loop iteration of reactor A, minus epoll_wait()
+void ServerBench::tick(const std::string &line, Stats &stall, Stats &locked)
+{
+	unsigned long start = nowUs();
+	{
+		StateLock lock(_state);
+		if (!line.empty())
+			_a.parseCommand(_a._clients[0]->getFd(), StringView(line));
+		if (Channel::hasBacklog())
+			Channel::advanceBacklogs();
+	}
+	locked.add(nowUs() - start);
+	_a.flushPendingClients();
+	stall.add(nowUs() - start);
+}
+
+void ServerBench::drain()
+{
+	_a.flushPendingClients();
+	char buf[65536];
+	for (size_t i = 0; i < _peers.size(); i++)
+		while (read(_peers[i], buf, sizeof(buf)) > 0)
+			;
+	Log::flush();
+}
+
+void *ServerBench::otherReactor(void *arg)
+{
+	ServerBench *bench = static_cast<ServerBench *>(arg);
+	Server::_current = &bench->_b;
+	char buf[4096];
+	while (__sync_fetch_and_add(&bench->_bRunning, 0))
+	{
+		unsigned long start = nowUs();
+		{
+			StateLock lock(bench->_state);
+			bench->_b.parseCommand(bench->_bFd, StringView("WHO other"));
+		}
+		bench->_bWait.add(nowUs() - start);
+		bench->_b.flushPendingClients();
+		while (read(bench->_bPeer, buf, sizeof(buf)) > 0)
+			;
+		usleep(100);
+	}
+	return NULL;
+}
+
+void ServerBench::measure(const char *name, unsigned long rounds)
+{
+	Stats stall;
+	Stats locked;
+	_bWait = Stats();
+	__sync_lock_test_and_set(&_bRunning, 1);
+	pthread_t other;
+	pthread_create(&other, NULL, otherReactor, this);
+	for (unsigned long r = 0; r < rounds; r++)
+	{
+		tick("PRIVMSG #big :hello, this is a fan-out benchmark", stall, locked);
+		while (Channel::hasBacklog())
+			tick("", stall, locked);
+		drain();
+	}
+	__sync_lock_release(&_bRunning);
+	pthread_join(other, NULL);
+	printf("%-18s %6.1f %10lu %10lu %10lu %10lu %10lu\n", name,
+		static_cast<double>(stall.count) / rounds, stall.avg(), stall.max,
+		locked.avg(), _bWait.avg(), _bWait.max);
+}
+
+int main(int ac, char **av)
+{
+	size_t members = ac > 1 ? strtoul(av[1], NULL, 10) : 8000;
+	unsigned long rounds = ac > 2 ? strtoul(av[2], NULL, 10) : 100;
+	unsigned int workers = ac > 3 ? strtoul(av[3], NULL, 10) : 2;
+	if (members == 0 || rounds == 0 || workers == 0)
+	{
+		fprintf(stderr, "usage: %s [members] [rounds] [workers]\n", av[0]);
+		return 1;
+	}
+	Log::configure("error", NULL);
+	ServerBench bench(members);
+	printf("#big with %lu members, %lu PRIVMSGs, %ld CPUs; times in us\n"
+		"ticks: loop iterations per broadcast; stall: one iteration (flush\n"
+		"included); locked: part of it under the ServerState lock; B wait: one\n"
+		"command on the other reactor, lock wait included\n\n",
+		static_cast<unsigned long>(members), rounds, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-18s %6s %10s %10s %10s %10s %10s\n", "", "ticks", "stall avg", "stall max",
+		"locked avg", "B wait avg", "B wait max");
+	// without the pool a channel this large is delivered in slices
+	bench.measure("no pool", rounds);
+	FanoutPool::start(workers);
+	char name[32];
+	snprintf(name, sizeof(name), "pool, %u workers", workers);
+	bench.measure(name, rounds);
+	FanoutPool::stop();
+	return 0;
+}
@@ -0,0 +1,187 @@
+// Checks that broadcasts delivered in slices (BROADCAST_SLICE, see
+// include/channel.hpp) reach every member in order, and are not overtaken
+// by a NICK or QUIT sent after them. Built with a tiny BROADCAST_SLICE so a
+// dozen clients are enough; clients are socketpair ends registered straight
+// into a Server, which is driven one loop iteration at a time.
+//
+//   make check
+
+#include "server.hpp"
+#include "channel.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// defined next to main() in src/main.cpp, which is not linked in
+volatile std::sig_atomic_t g_running = 1;
+
+#define CHECK_MEMBERS 12
+
+class ServerBench
+{
+	public:
+		ServerBench();
+		~ServerBench();
+		void send(size_t client, const std::string &line);
+		void finishTick();
+		std::vector<std::string> received(size_t client);
+
+	private:
+		ServerState			_state;
+		Server				_server;
+		std::vector<int>	_fds;
+		std::vector<int>	_peers;
+};
+
+ServerBench::ServerBench() : _state(false), _server(0, "check", _state)
+{
+	Server::_current = &_server;
+	for (size_t i = 0; i < CHECK_MEMBERS; i++)
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		fcntl(sv[0], F_SETFL, O_NONBLOCK);
+		fcntl(sv[1], F_SETFL, O_NONBLOCK);
+		_server.addClient(new Client(sv[0], &_server));
+		_fds.push_back(sv[0]);
+		_peers.push_back(sv[1]);
+		char nick[16];
+		snprintf(nick, sizeof(nick), "user%lu", static_cast<unsigned long>(i));
+		send(i, "PASS check");
+		send(i, std::string("NICK ") + nick);
+		send(i, std::string("USER ") + nick + " 0 * :" + nick);
+		send(i, "JOIN #big");
+		finishTick();
+	}
+	for (size_t i = 0; i < CHECK_MEMBERS; i++)
+		received(i);
+}
+
+ServerBench::~ServerBench()
+{
+	for (size_t i = 0; i < _peers.size(); i++)
+		close(_peers[i]);
+	Server::_current = NULL;
+}
+
+// A line as if read from the client's socket in the current iteration
+void ServerBench::send(size_t client, const std::string &line)
+{
+	_server.parseCommand(_fds[client], StringView(line));
+}
+
+// The end of Server::run()'s iteration, repeated until no channel has a
+// backlog left
+void ServerBench::finishTick()
+{
+	do
+	{
+		if (Channel::hasBacklog())
+			Channel::advanceBacklogs();
+		_server.reapDeadClients();
+		_server.flushPendingClients();
+	}
+	while (Channel::hasBacklog());
+	Log::flush();
+}
+
+std::vector<std::string> ServerBench::received(size_t client)
+{
+	std::string data;
+	char buf[65536];
+	ssize_t len;
+	while ((len = read(_peers[client], buf, sizeof(buf))) > 0)
+		data.append(buf, len);
+	std::vector<std::string> lines;
+	size_t start = 0;
+	size_t end;
+	while ((end = data.find("\r\n", start)) != std::string::npos)
+	{
+		lines.push_back(data.substr(start, end - start));
+		start = end + 2;
+	}
+	return lines;
+}
+
+namespace
+{
+	int g_failures = 0;
+
+	// index of the first line containing text, or -1
+	int find(const std::vector<std::string> &lines, const std::string &text)
+	{
+		for (size_t i = 0; i < lines.size(); i++)
+			if (lines[i].find(text) != std::string::npos)
+				return i;
+		return -1;
+	}
+
+	void expectBefore(const char *check, size_t member, const std::vector<std::string> &lines,
+		const std::string &first, const std::string &second)
+	{
+		int a = find(lines, first);
+		int b = find(lines, second);
+		if (a == -1 || b == -1 || a > b)
+		{
+			printf("FAIL %s: user%lu got \"%s\" at %d, \"%s\" at %d\n", check,
+				static_cast<unsigned long>(member), first.c_str(), a, second.c_str(), b);
+			g_failures++;
+		}
+	}
+}
+
+int main()
+{
+	Log::configure("error", NULL);
+	ServerBench bench;
+
+	// a burst from one member, all in one iteration
+	for (int i = 0; i < 5; i++)
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "PRIVMSG #big :burst %d", i);
+		bench.send(0, line);
+	}
+	bench.finishTick();
+	for (size_t m = 1; m < CHECK_MEMBERS; m++)
+	{
+		std::vector<std::string> lines = bench.received(m);
+		for (int i = 0; i < 4; i++)
+		{
+			char a[32];
+			char b[32];
+			snprintf(a, sizeof(a), ":burst %d", i);
+			snprintf(b, sizeof(b), ":burst %d", i + 1);
+			expectBefore("burst order", m, lines, a, b);
+		}
+	}
+
+	// NICK right after a PRIVMSG that is still being sliced
+	bench.send(0, "PRIVMSG #big :first");
+	bench.send(0, "NICK renamed");
+	bench.send(0, "PRIVMSG #big :second");
+	bench.finishTick();
+	for (size_t m = 1; m < CHECK_MEMBERS; m++)
+	{
+		std::vector<std::string> lines = bench.received(m);
+		expectBefore("PRIVMSG then NICK", m, lines, "PRIVMSG #big :first", " NICK ");
+		expectBefore("NICK then PRIVMSG", m, lines, " NICK ", "PRIVMSG #big :second");
+	}
+
+	// QUIT right after a PRIVMSG that is still being sliced
+	size_t last = CHECK_MEMBERS - 1;
+	bench.send(last, "PRIVMSG #big :leaving");
+	bench.send(last, "QUIT :bye");
+	bench.finishTick();
+	for (size_t m = 0; m < last; m++)
+		expectBefore("PRIVMSG then QUIT", m, bench.received(m), "PRIVMSG #big :leaving", " QUIT ");
+
+	if (g_failures)
+		return 1;
+	printf("ordercheck: all checks passed (BROADCAST_SLICE %d, %d members)\n",
+		BROADCAST_SLICE, CHECK_MEMBERS);
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Decoder for the binary trace written by ircserv (see include/trace.hpp).
+// Prints the records still in the ring, oldest first, then per-command
+// counts and latencies.
+//
+//   ./tracedump <file> [last N records]
+
+#include "trace.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const char *eventName(uint16_t event)
+	{
+		switch (event)
+		{
+			case TRACE_ACCEPT: return "ACCEPT";
+			case TRACE_REFUSED: return "REFUSED";
+			case TRACE_READ: return "READ";
+			case TRACE_COMMAND: return "COMMAND";
+			case TRACE_DROP: return "DROP";
+			case TRACE_DISCONNECT: return "DISCONNECT";
+		}
+		return "?";
+	}
+
+	struct CommandStats
+	{
+		unsigned long	count;
+		uint64_t		total;
+		uint64_t		max;
+	};
+
+	void printTime(uint64_t ns)
+	{
+		time_t secs = ns / 1000000000ULL;
+		char buf[32];
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+		printf("%s.%09lu", buf, static_cast<unsigned long>(ns % 1000000000ULL));
+	}
+}
+
+int main(int ac, char **av)
+{
+	if (ac != 2 && ac != 3)
+	{
+		fprintf(stderr, "usage: %s <trace file> [count]\n", av[0]);
+		return 1;
+	}
+	FILE *file = fopen(av[1], "rb");
+	if (!file)
+	{
+		perror(av[1]);
+		return 1;
+	}
+	TraceHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+		|| memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord))
+	{
+		fprintf(stderr, "%s: not a version %d trace file\n", av[1], TRACE_VERSION);
+		fclose(file);
+		return 1;
+	}
+	std::vector<TraceRecord> records(header.capacity);
+	size_t loaded = fread(&records[0], sizeof(TraceRecord), records.size(), file);
+	fclose(file);
+	if (loaded != records.size())
+	{
+		fprintf(stderr, "%s: truncated trace file\n", av[1]);
+		return 1;
+	}
+
+	uint64_t first = header.head > header.capacity ? header.head - header.capacity : 0;
+	if (ac == 3)
+	{
+		uint64_t count = strtoull(av[2], NULL, 10);
+		if (header.head - first > count)
+			first = header.head - count;
+	}
+	printf("%llu records written, showing %llu\n",
+		static_cast<unsigned long long>(header.head),
+		static_cast<unsigned long long>(header.head - first));
+
+	CommandStats stats[TRACE_MAX_COMMANDS + 1];
+	memset(stats, 0, sizeof(stats));
+	for (uint64_t i = first; i < header.head; i++)
+	{
+		const TraceRecord &r = records[i % header.capacity];
+		// torn by a crash, or overwritten while the file was copied
+		if (r.seq != static_cast<uint32_t>(i + 1))
+		{
+			printf("#%llu: incomplete record\n", static_cast<unsigned long long>(i));
+			continue;
+		}
+		printTime(header.startRealtime + r.time);
+		printf(" %-10s fd=%d", eventName(r.event), r.fd);
+		if (r.event == TRACE_COMMAND)
+		{
+			unsigned int id = r.command < TRACE_MAX_COMMANDS ? r.command : TRACE_MAX_COMMANDS;
+			const char *name = (id < TRACE_MAX_COMMANDS && header.commands[id][0])
+				? header.commands[id] : "(unknown)";
+			printf(" %-8s %uns", name, r.latency);
+			stats[id].count++;
+			stats[id].total += r.latency;
+			if (r.latency > stats[id].max)
+				stats[id].max = r.latency;
+		}
+		if (r.bytes)
+			printf(" %lluB", static_cast<unsigned long long>(r.bytes));
+		printf("\n");
+	}
+
+	printf("\n%-10s %10s %12s %12s\n", "command", "count", "avg ns", "max ns");
+	for (unsigned int id = 0; id <= TRACE_MAX_COMMANDS; id++)
+	{
+		if (!stats[id].count)
+			continue;
+		const char *name = (id < TRACE_MAX_COMMANDS && header.commands[id][0])
+			? header.commands[id] : "(unknown)";
+		printf("%-10s %10lu %12llu %12llu\n", name, stats[id].count,
+			static_cast<unsigned long long>(stats[id].total / stats[id].count),
+			static_cast<unsigned long long>(stats[id].max));
+	}
+	return 0;
+}